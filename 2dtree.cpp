@@ -1,57 +1,149 @@
 #include "primitives.h"
 
-#include <fstream>
+#include "ingest.h"
+
 #include <map>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace {
-std::vector<Point> read(const char * filename)
+bool scan_contains(const Point * points, std::size_t n, const Point & key)
 {
-    std::ifstream in;
-    in.open(filename);
-    std::vector<Point> result;
-    double x, y;
-    while (in >> x) {
-        in >> y;
-        result.emplace_back(x, y);
+    std::size_t i = 0;
+    bool found = false;
+#ifdef __SSE2__
+    static_assert(sizeof(Point) == 2 * sizeof(double), "Point must be two packed doubles");
+    const double * data = reinterpret_cast<const double *>(points);
+    const __m128d kx = _mm_set1_pd(key.x());
+    const __m128d ky = _mm_set1_pd(key.y());
+#ifdef POINT_APPROX_COMPARE
+    const __m128d eps = _mm_set1_pd(EPS);
+    const __m128d sign = _mm_set1_pd(-0.0);
+#endif
+    __m128d any = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2) {
+        __m128d a = _mm_loadu_pd(data + 2 * i);
+        __m128d b = _mm_loadu_pd(data + 2 * i + 2);
+#ifdef POINT_APPROX_COMPARE
+        __m128d dx = _mm_andnot_pd(sign, _mm_sub_pd(_mm_unpacklo_pd(a, b), kx));
+        __m128d dy = _mm_andnot_pd(sign, _mm_sub_pd(_mm_unpackhi_pd(a, b), ky));
+        any = _mm_or_pd(any, _mm_and_pd(_mm_cmplt_pd(dx, eps), _mm_cmplt_pd(dy, eps)));
+#else
+        any = _mm_or_pd(any, _mm_and_pd(_mm_cmpeq_pd(_mm_unpacklo_pd(a, b), kx), _mm_cmpeq_pd(_mm_unpackhi_pd(a, b), ky)));
+#endif
     }
-    return result;
+    found = _mm_movemask_pd(any) != 0;
+#endif
+    for (; i < n; ++i) {
+        found |= double_equal(points[i].x(), key.x()) & double_equal(points[i].y(), key.y());
+    }
+    return found;
 }
 } // namespace
 
 namespace kdtree {
 using iterator = PointSet::iterator;
 PointSet::PointSet(const std::string & filename)
+    : PointSet(filename.empty() ? std::vector<Point>() : ingest::read_points(filename))
+{
+}
+
+PointSet::PointSet(std::vector<Point> points, unsigned threads)
     : root(nullptr)
 {
-    if (!filename.empty()) {
-        std::vector<Point> points = read(filename.c_str());
-        balancing(points.begin(), points.end(), Orientation::Vertical);
+    if (points.empty()) {
+        return;
+    }
+    KDTREE_LATENCY_SCOPE(latency::Op::Build);
+    if (!std::is_sorted(points.begin(), points.end(), LessXY())) {
+        std::sort(points.begin(), points.end(), LessXY());
+    }
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    // Sorted and free of duplicates, so it can become the flat array as is.
+    if (points.size() <= flat_limit_) {
+        flat = std::move(points);
+    }
+    else {
+        root = balancing(points.begin(), points.end(), Orientation::Vertical, threads ? threads : std::thread::hardware_concurrency());
     }
 }
 
-void PointSet::balancing(std::vector<Point>::iterator begin, std::vector<Point>::iterator end, PointSet::Orientation now)
+void PointSet::set_flat_limit(std::size_t limit)
+{
+    flat_limit_ = limit;
+    if (root == nullptr && flat.size() > flat_limit_) {
+        grow_tree();
+    }
+}
+
+void PointSet::grow_tree()
+{
+    std::vector<Point> points;
+    points.swap(flat);
+    root = balancing(points.begin(), points.end(), Orientation::Vertical, 1);
+}
+
+bool PointSet::flat_contains(const Point & key) const
+{
+    return scan_contains(flat.data(), flat.size(), key);
+}
+
+std::shared_ptr<PointSet::Node> PointSet::balancing(std::vector<Point>::iterator begin, std::vector<Point>::iterator end, PointSet::Orientation now, unsigned threads)
 {
     if (begin == end) {
-        return;
+        return nullptr;
     }
-    std::sort(begin, end, [now](auto p1, auto p2) { return (now == Orientation::Vertical) ? (p1.x() < p2.x()) : (p1.y() < p2.y()); });
-    auto middle = begin + (end - begin) / 2;
-    put(*middle);
-    balancing(begin, middle, next(now));
-    balancing(++middle, end, next(now));
+    const bool vertical = now == Orientation::Vertical;
+    auto median = begin + (end - begin) / 2;
+    if (vertical) {
+        std::nth_element(begin, median, end, LessX());
+    }
+    else {
+        std::nth_element(begin, median, end, LessY());
+    }
+    // tree_put sends keys equal on the axis to the right, so the node is the
+    // first point with the median value and the left part is strictly below.
+    const double value = vertical ? median->x() : median->y();
+    auto middle = std::partition(begin, median, [vertical, value](const Point & p) { return (vertical ? p.x() : p.y()) < value; });
+    std::iter_swap(middle, median);
+
+    auto node = std::make_shared<Node>(*middle, now);
+    node->size = static_cast<std::size_t>(end - begin);
+    if (threads > 1 && end - begin > (1 << 14)) {
+        std::thread left([&] { node->left = balancing(begin, middle, next(now), threads / 2); });
+        node->right = balancing(middle + 1, end, next(now), threads - threads / 2);
+        left.join();
+    }
+    else {
+        node->left = balancing(begin, middle, next(now), 1);
+        node->right = balancing(middle + 1, end, next(now), 1);
+    }
+    return node;
 }
 
 bool PointSet::empty() const
 {
-    return root == nullptr || (root->size) == 0u;
+    return root == nullptr ? flat.empty() : (root->size) == 0u;
 }
 
-bool PointSet::contains(const Point & key) const
+bool PointSet::contains(const Point & raw_key) const
 {
+    KDTREE_LATENCY_SCOPE(latency::Op::Contains);
+    const Point key = snapped(raw_key);
+    if (hash_) {
+        return hash_->contains(key.x(), key.y());
+    }
+    if (root == nullptr) {
+        return flat_contains(key);
+    }
     std::shared_ptr<Node> now = root;
     while (now != nullptr) {
         if (now->point == key) {
-            return true;
+            return !now->erased;
         }
         if ((now->orientation == Orientation::Vertical && key.x() >= now->point.x()) ||
             (now->orientation == Orientation::Horizontal && key.y() >= now->point.y())) {
@@ -64,23 +156,276 @@ bool PointSet::contains(const Point & key) const
     return false;
 }
 
+bool PointSet::erase(const Point & raw_key)
+{
+    KDTREE_LATENCY_SCOPE(latency::Op::Erase);
+    const Point key = snapped(raw_key);
+    if (hash_ && !hash_->erase(key.x(), key.y())) {
+        return false;
+    }
+    if (root == nullptr) {
+        auto it = std::find(flat.begin(), flat.end(), key);
+        if (it == flat.end()) {
+            return false;
+        }
+        *it = flat.back();
+        flat.pop_back();
+        return true;
+    }
+    Node * node = root.get();
+    while (node != nullptr && node->point != key) {
+        if ((node->orientation == Orientation::Vertical && key.x() >= node->point.x()) ||
+            (node->orientation == Orientation::Horizontal && key.y() >= node->point.y())) {
+            node = node->right.get();
+        }
+        else {
+            node = node->left.get();
+        }
+    }
+    if (node == nullptr || node->erased) {
+        return false;
+    }
+    node->erased = true;
+    adjust_sizes(key, false);
+    if (++tombstones_ > root->size) {
+        drop_tombstones();
+    }
+    return true;
+}
+
+void PointSet::adjust_sizes(const Point & key, bool grow)
+{
+    for (Node * node = root.get(); node != nullptr;) {
+        if (grow) {
+            node->size++;
+        }
+        else {
+            node->size--;
+        }
+        if (node->point == key) {
+            return;
+        }
+        if ((node->orientation == Orientation::Vertical && key.x() >= node->point.x()) ||
+            (node->orientation == Orientation::Horizontal && key.y() >= node->point.y())) {
+            node = node->right.get();
+        }
+        else {
+            node = node->left.get();
+        }
+    }
+}
+
+void PointSet::revive(Node * node)
+{
+    node->erased = false;
+    --tombstones_;
+    adjust_sizes(node->point, true);
+}
+
+void PointSet::drop_tombstones()
+{
+    std::vector<Point> points(begin(), end());
+    root = nullptr;
+    tombstones_ = 0;
+    if (points.size() <= flat_limit_) {
+        flat = std::move(points);
+    }
+    else {
+        root = balancing(points.begin(), points.end(), Orientation::Vertical, std::thread::hardware_concurrency());
+    }
+}
+
 std::size_t PointSet::size() const
 {
-    return (root ? root->size : 0u);
+    return (root ? root->size : flat.size());
 }
 
-void PointSet::put(const Point & key)
+TreeStats PointSet::stats() const
+{
+    // make_shared puts the control block (two counters and a vtable pointer)
+    // in the same allocation as the node; malloc adds its own header.
+    constexpr std::size_t control_block = 2 * sizeof(int) + sizeof(void *);
+    constexpr std::size_t malloc_header = sizeof(std::max_align_t);
+
+    TreeStats result;
+    if (root == nullptr) {
+        result.size = flat.size();
+        result.flat = true;
+        result.node_bytes = flat.capacity() * sizeof(Point);
+        result.allocator_overhead_bytes = flat.capacity() != 0 ? malloc_header : 0;
+        return result;
+    }
+    std::size_t leaf_depth_sum = 0;
+    std::vector<std::pair<const Node *, std::size_t>> stack;
+    if (root) {
+        stack.emplace_back(root.get(), 0);
+    }
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        ++(node->erased ? result.tombstones : result.size);
+        if (result.depth_counts.size() <= depth) {
+            result.depth_counts.resize(depth + 1);
+        }
+        ++result.depth_counts[depth];
+        result.height = std::max(result.height, depth + 1);
+        if (!node->left && !node->right) {
+            ++result.leaves;
+            leaf_depth_sum += depth;
+        }
+        if (node->size >= 3) {
+            std::size_t heavier = std::max(node->left ? node->left->size : 0, node->right ? node->right->size : 0);
+            double share = static_cast<double>(heavier) / (node->size - (node->erased ? 0 : 1));
+            if (share > result.worst_imbalance) {
+                result.worst_imbalance = share;
+                result.worst_imbalance_size = node->size;
+            }
+        }
+        if (node->left) {
+            stack.emplace_back(node->left.get(), depth + 1);
+        }
+        if (node->right) {
+            stack.emplace_back(node->right.get(), depth + 1);
+        }
+    }
+    if (result.leaves != 0) {
+        result.average_leaf_depth = static_cast<double>(leaf_depth_sum) / result.leaves;
+    }
+    const std::size_t nodes = result.size + result.tombstones;
+    result.node_bytes = nodes * sizeof(Node);
+    result.allocator_overhead_bytes = nodes * (control_block + malloc_header);
+    return result;
+}
+
+Point PointSet::snapped(const Point & key) const
+{
+    if (snap_ <= 0) {
+        return key;
+    }
+    return {std::round(key.x() / snap_) * snap_, std::round(key.y() / snap_) * snap_};
+}
+
+void PointSet::put(const Point & raw_key)
+{
+    KDTREE_LATENCY_SCOPE(latency::Op::Put);
+    const Point key = snapped(raw_key);
+    if (!hash_) {
+        put_impl(key);
+        return;
+    }
+    if (hash_->contains(key.x(), key.y())) {
+        // What the tree would do with an exact duplicate.
+        if (merge_tolerance_ > 0) {
+            merge(key, key);
+        }
+        return;
+    }
+    const std::size_t before = size();
+    put_impl(key);
+    if (size() != before) {
+        hash_->insert(key.x(), key.y());
+    }
+}
+
+void PointSet::set_hash_index(bool enabled)
+{
+    if (!enabled) {
+        hash_.reset();
+        return;
+    }
+    if (hash_) {
+        return;
+    }
+    hash_.emplace();
+    hash_->reserve(size());
+    for (const auto & point : *this) {
+        hash_->insert(point.x(), point.y());
+    }
+}
+
+void PointSet::put_impl(const Point & key)
+{
+    if (root != nullptr) {
+        tree_put(key);
+        return;
+    }
+    if (merge_tolerance_ > 0) {
+        for (const auto & point : flat) {
+            if (key.distance(point) <= merge_tolerance_) {
+                merge(point, key);
+                return;
+            }
+        }
+    }
+    else if (flat_contains(key)) {
+        return;
+    }
+    flat.push_back(key);
+    if (flat.size() > flat_limit_) {
+        grow_tree();
+    }
+}
+
+const PointSet::Node * PointSet::find_within(const Point & key, const Node * node) const
+{
+    if (node == nullptr) {
+        return nullptr;
+    }
+    if (!node->erased && key.distance(node->point) <= merge_tolerance_) {
+        return node;
+    }
+    double offset = node->orientation == Orientation::Vertical ? key.x() - node->point.x() : key.y() - node->point.y();
+    if (const Node * found = find_within(key, offset >= 0 ? node->right.get() : node->left.get())) {
+        return found;
+    }
+    if (std::abs(offset) <= merge_tolerance_) {
+        return find_within(key, offset >= 0 ? node->left.get() : node->right.get());
+    }
+    return nullptr;
+}
+
+void PointSet::merge(const Point & stored, const Point & incoming) const
+{
+    if (on_merge_) {
+        on_merge_(stored, incoming);
+    }
+}
+
+void PointSet::tree_put(const Point & key)
 {
     Orientation now_orientation = Orientation::Vertical;
     std::shared_ptr<Node> now, prev = nullptr;
     now = root;        // NOLINT
     bool is_now_right; // false - left, true - right
+    // Subtrees across a splitting line closer than the merge tolerance; they
+    // are probed once the descent reaches the bottom.
+    std::vector<const Node *> probes;
+    // A tombstone holding the key itself, brought back if nothing live is
+    // close enough to merge with.
+    Node * tombstone = nullptr;
     while (now != nullptr) {
-        if (key == now->point) {
+        if (merge_tolerance_ > 0) {
+            if (now->erased) {
+                if (key == now->point) {
+                    tombstone = now.get();
+                }
+            }
+            else if (key.distance(now->point) <= merge_tolerance_) {
+                merge(now->point, key);
+                return;
+            }
+            double offset = now->orientation == Orientation::Vertical ? key.x() - now->point.x() : key.y() - now->point.y();
+            if (std::abs(offset) <= merge_tolerance_) {
+                probes.push_back(offset >= 0 ? now->left.get() : now->right.get());
+            }
+        }
+        else if (key == now->point) {
+            if (now->erased) {
+                revive(now.get());
+            }
             return;
         }
         prev = now;
-        prev->size++;
         if ((now->orientation == Orientation::Vertical && key.x() >= now->point.x()) ||
             (now->orientation == Orientation::Horizontal && key.y() >= now->point.y())) {
             is_now_right = true;
@@ -92,6 +437,18 @@ void PointSet::put(const Point & key)
         }
         now_orientation = next(now_orientation);
     }
+    for (const Node * probe : probes) {
+        if (const Node * near = find_within(key, probe)) {
+            merge(near->point, key);
+            return;
+        }
+    }
+    if (tombstone != nullptr) {
+        revive(tombstone);
+        return;
+    }
+    // The key is new: only now grow the subtree sizes along its path.
+    adjust_sizes(key, true);
     now = std::make_shared<Node>(key, now_orientation);
     if (prev) {
         if (is_now_right) {
@@ -112,13 +469,18 @@ void PointSet::print(std::ostream & out, const std::shared_ptr<Node> & node)
         return;
     }
     print(out, node->left);
-    out << '\t' << node->point << ",\n";
+    if (!node->erased) {
+        out << '\t' << node->point << ",\n";
+    }
     print(out, node->right);
 }
 
 std::ostream & operator<<(std::ostream & out, const PointSet & set)
 {
     out << "PointSet {\n";
+    for (const auto & point : set.flat) {
+        out << '\t' << point << ",\n";
+    }
     PointSet::print(out, set.root);
     out << "}";
     return out;
@@ -154,29 +516,121 @@ std::pair<Rect, Rect> PointSet::split(const Rect & rect_now, const Point & node_
 
 std::pair<iterator, iterator> PointSet::range(const Rect & key) const
 {
+    QueryStats stats;
+    return range(key, stats);
+}
+
+std::pair<iterator, iterator> PointSet::range(const Rect & key, QueryStats & stats) const
+{
+    KDTREE_LATENCY_SCOPE(latency::Op::Range);
+    if (root == nullptr) {
+        KDTREE_STATS(stats.distance_evaluations += flat.size());
+        KDTREE_STATS(traversal_stats_.range.record(stats));
+        auto result = std::make_shared<std::vector<Point>>();
+        for (const auto & point : flat) {
+            if (key.contains(point)) {
+                result->push_back(point);
+            }
+        }
+        if (result->empty()) {
+            return {};
+        }
+        std::sort(result->begin(), result->end());
+        return {iterator(std::move(result)), {}};
+    }
     std::set<Point> ans_set;
     Rect rect_now = Rect(Point(-INF, -INF), Point(INF, INF));
-    range_impl(key, root, ans_set, rect_now);
+    range_impl(key, root, ans_set, rect_now, stats, 0);
+    KDTREE_STATS(traversal_stats_.range.record(stats));
     if (ans_set.empty()) {
         return {};
     }
     return {save_tree(ans_set), {}};
 }
 
-void PointSet::range_impl(const Rect & key, const std::shared_ptr<Node> & node, std::set<Point> & ans_set, const Rect & rect_now) const
+void PointSet::range_impl(const Rect & key, const std::shared_ptr<Node> & node, std::set<Point> & ans_set, const Rect & rect_now, [[maybe_unused]] QueryStats & stats, [[maybe_unused]] std::size_t depth) const
 {
     if (node == nullptr) {
         return;
     }
     if (!key.intersects(rect_now)) {
+        KDTREE_STATS(++stats.subtrees_pruned);
         return;
     }
-    if (key.contains(node->point)) {
+    KDTREE_STATS(stats.visit(depth));
+    KDTREE_STATS(++stats.distance_evaluations);
+    if (!node->erased && key.contains(node->point)) {
         ans_set.insert(node->point);
     }
     auto [rect_left, rect_right] = split(rect_now, node->point, node->orientation);
-    range_impl(key, node->left, ans_set, rect_left);
-    range_impl(key, node->right, ans_set, rect_right);
+    range_impl(key, node->left, ans_set, rect_left, stats, depth + 1);
+    range_impl(key, node->right, ans_set, rect_right, stats, depth + 1);
+}
+
+std::vector<std::pair<Point, std::uint64_t>> PointSet::range(const std::vector<Rect> & rects) const
+{
+    if (rects.size() > 64) {
+        throw std::length_error("PointSet::range: more than 64 rects");
+    }
+    KDTREE_LATENCY_SCOPE(latency::Op::Range);
+    std::vector<std::pair<Point, std::uint64_t>> result;
+    if (rects.empty()) {
+        return result;
+    }
+    const std::uint64_t all = rects.size() == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << rects.size()) - 1;
+    if (root == nullptr) {
+        for (const auto & point : flat) {
+            std::uint64_t mask = 0;
+            for (std::size_t i = 0; i < rects.size(); ++i) {
+                mask |= std::uint64_t(rects[i].contains(point)) << i;
+            }
+            if (mask != 0) {
+                result.emplace_back(point, mask);
+            }
+        }
+    }
+    else {
+        multi_range_impl(rects, root.get(), 0, all, Rect(Point(-INF, -INF), Point(INF, INF)), result);
+    }
+    std::sort(result.begin(), result.end(), [](const auto & a, const auto & b) { return LessXY()(a.first, b.first); });
+    return result;
+}
+
+void PointSet::multi_range_impl(const std::vector<Rect> & rects, const Node * node, std::uint64_t covered, std::uint64_t active, const Rect & rect_now, std::vector<std::pair<Point, std::uint64_t>> & result) const
+{
+    if (node == nullptr) {
+        return;
+    }
+    // Sort the overlapping rects against this cell: drop the ones that miss
+    // it and stop testing points against the ones that hold all of it.
+    for (std::uint64_t rest = active; rest != 0; rest &= rest - 1) {
+        const int i = __builtin_ctzll(rest);
+        const Rect & rect = rects[i];
+        const std::uint64_t bit = std::uint64_t(1) << i;
+        if (!rect.intersects(rect_now)) {
+            active &= ~bit;
+        }
+        else if (rect.contains(rect_now.left_bottom()) && rect.contains(rect_now.right_top())) {
+            active &= ~bit;
+            covered |= bit;
+        }
+    }
+    if (covered == 0 && active == 0) {
+        return;
+    }
+    if (!node->erased) {
+        std::uint64_t mask = covered;
+        for (std::uint64_t rest = active; rest != 0; rest &= rest - 1) {
+            const int i = __builtin_ctzll(rest);
+            mask |= std::uint64_t(rects[i].contains(node->point)) << i;
+        }
+        if (mask != 0) {
+            result.emplace_back(node->point, mask);
+        }
+    }
+    auto [rect_left, rect_right] = split(rect_now, node->point, node->orientation);
+    multi_range_impl(rects, node->left.get(), covered, active, rect_left, result);
+    multi_range_impl(rects, node->right.get(), covered, active, rect_right, result);
 }
 
 std::optional<Point> PointSet::nearest(const Point & key) const
@@ -190,42 +644,82 @@ std::optional<Point> PointSet::nearest(const Point & key) const
 
 std::pair<iterator, iterator> PointSet::nearest(const Point & key, std::size_t k) const
 {
+    QueryStats stats;
+    return nearest(key, k, stats);
+}
+
+std::pair<iterator, iterator> PointSet::nearest(const Point & key, std::size_t k, QueryStats & stats) const
+{
+    KDTREE_LATENCY_SCOPE(latency::Op::Nearest);
     if (k == 0) {
         return {};
     }
+    if (root == nullptr) {
+        if (flat.empty()) {
+            return {};
+        }
+        return {iterator(flat_nearest(key, k, stats)), {}};
+    }
     pool::Pool * pool = PoolAllocator<map_node>::create_pool(k + 1);
     std::set<Point> set;
     {
         PoolAllocator<map_node> alloc(*pool);
         point_map ans_set(alloc);
         Rect rect_now = Rect(Point(-INF, -INF), Point(INF, INF));
-        nearest_impl(key, k, root, ans_set, rect_now);
-        if (ans_set.empty()) {
-            return {};
-        }
+        nearest_impl(key, k, root, ans_set, rect_now, stats, 0);
+        KDTREE_STATS(traversal_stats_.nearest.record(stats));
         for (const auto & [dist, point] : ans_set) {
             set.insert(point);
         }
     }
     PoolAllocator<map_node>::destroy_pool(pool);
+    if (set.empty()) {
+        return {};
+    }
     return {save_tree(set), {}};
 }
 
-void PointSet::nearest_impl(const Point & key, size_t k, const std::shared_ptr<Node> & node, point_map & ans_set, const Rect & rect_now) const
+std::shared_ptr<const std::vector<Point>> PointSet::flat_nearest(const Point & key, std::size_t k, [[maybe_unused]] QueryStats & stats) const
+{
+    KDTREE_STATS(stats.distance_evaluations += flat.size());
+    std::vector<std::pair<double, std::size_t>> distances(flat.size());
+    for (std::size_t i = 0; i < flat.size(); ++i) {
+        double dx = flat[i].x() - key.x();
+        double dy = flat[i].y() - key.y();
+        distances[i] = {dx * dx + dy * dy, i};
+    }
+    k = std::min(k, distances.size());
+    std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+    auto result = std::make_shared<std::vector<Point>>();
+    result->reserve(k);
+    for (std::size_t i = 0; i < k; ++i) {
+        result->push_back(flat[distances[i].second]);
+    }
+    std::sort(result->begin(), result->end());
+    KDTREE_STATS(traversal_stats_.nearest.record(stats));
+    return result;
+}
+
+void PointSet::nearest_impl(const Point & key, size_t k, const std::shared_ptr<Node> & node, point_map & ans_set, const Rect & rect_now, [[maybe_unused]] QueryStats & stats, [[maybe_unused]] std::size_t depth) const
 {
     if (node == nullptr) {
         return;
     }
-    ans_set.emplace(key.distance(node->point), node->point);
-    if (ans_set.size() > k) {
-        ans_set.erase(--ans_set.end());
+    KDTREE_STATS(stats.visit(depth));
+    KDTREE_STATS(stats.distance_evaluations += 2);
+    if (!node->erased) {
+        ans_set.emplace(key.distance(node->point), node->point);
+        if (ans_set.size() > k) {
+            ans_set.erase(--ans_set.end());
+        }
     }
-    if (rect_now.distance(key) > (--ans_set.end())->first) {
+    if (ans_set.size() == k && rect_now.distance(key) > (--ans_set.end())->first) {
+        KDTREE_STATS(++stats.subtrees_pruned);
         return;
     }
     auto [rect_left, rect_right] = split(rect_now, node->point, node->orientation);
-    nearest_impl(key, k, node->left, ans_set, rect_left);
-    nearest_impl(key, k, node->right, ans_set, rect_right);
+    nearest_impl(key, k, node->left, ans_set, rect_left, stats, depth + 1);
+    nearest_impl(key, k, node->right, ans_set, rect_right, stats, depth + 1);
 }
 
 } // namespace kdtree
\ No newline at end of file
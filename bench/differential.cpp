@@ -0,0 +1,688 @@
+#include "../bruteforce.h"
+#include "../ingest.h"
+#include "../quadtree.h"
+#include "../sfcindex.h"
+#include "workload.h"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Differential harness: runs randomized operation sequences against a
+ * tree backend (kdtree::PointSet by default) and bruteforce::PointSet,
+ * checks that the answers agree and times both side by side, then sweeps
+ * small sizes to find the crossover below which the linear scan wins.
+ *
+ *   g++ -std=c++17 -O2 bench/differential.cpp bench/workload.cpp 2dtree.cpp ingest.cpp bruteforce.cpp quadtree.cpp rectbatch.cpp sfcindex.cpp -pthread -o differential
+ *   ./differential --runs 50 --ops 20000 --seed 1 --crossover 4096 [--backend quadtree] [--mode snap]
+ *
+ * --mode picks how the tree is configured (exact, snap, merge, hash); by
+ * default the runs cycle through all of them.
+ *
+ * Exits with status 1 if any answer differs.
+ */
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+struct Options
+{
+    std::size_t runs = 20;
+    std::size_t ops = 5000;
+    std::uint64_t seed = 1;
+    std::size_t crossover = 4096;
+    std::size_t max_reports = 10;
+    std::string backend = "kdtree";
+    std::string mode = "all";
+};
+
+// How the kdtree::PointSet under test is configured; "all" cycles through
+// them, two runs each. Other backends run exact only.
+const char * const mode_names[] = {"exact", "snap", "merge", "hash"};
+
+enum Op
+{
+    Put,
+    Erase,
+    Contains,
+    Range,
+    MultiRange,
+    Nearest,
+    OpCount,
+};
+
+const char * const op_names[] = {"put", "erase", "contains", "range", "multirange", "nearest"};
+
+struct Timing
+{
+    double kdtree_ns[OpCount] = {};
+    double brute_ns[OpCount] = {};
+    std::size_t count[OpCount] = {};
+};
+
+template <class F>
+double time_ns(F && f)
+{
+    auto start = clock_type::now();
+    f();
+    return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+}
+
+template <class It>
+std::vector<Point> collect(std::pair<It, It> range)
+{
+    std::vector<Point> result(range.first, range.second);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<double> distances(const std::vector<Point> & points, const Point & key)
+{
+    std::vector<double> result;
+    for (const auto & p : points) {
+        result.push_back(key.distance(p));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+class Checker
+{
+public:
+    explicit Checker(const Options & options)
+        : options(options)
+    {
+    }
+
+    void fail(const std::string & what)
+    {
+        if (failures++ < options.max_reports) {
+            std::cerr << "MISMATCH " << what << '\n';
+        }
+    }
+
+    std::size_t failures = 0;
+
+private:
+    const Options & options;
+};
+
+// Backends without erase() (the quadtree) just never see Erase.
+template <class Set, class = void>
+struct has_erase : std::false_type
+{
+};
+template <class Set>
+struct has_erase<Set, std::void_t<decltype(std::declval<Set &>().erase(std::declval<const Point &>()))>> : std::true_type
+{
+};
+
+// bruteforce::PointSet plus the rules a configured kdtree::PointSet applies
+// to keys, spelled out the slow way.
+class Reference
+{
+public:
+    explicit Reference(double snap = 0, double tolerance = 0)
+        : snap(snap)
+        , tolerance(tolerance)
+    {
+    }
+
+    Point key(const Point & p) const
+    {
+        if (snap <= 0) {
+            return p;
+        }
+        return {std::round(p.x() / snap) * snap, std::round(p.y() / snap) * snap};
+    }
+
+    bool empty() const
+    {
+        return set.empty();
+    }
+    std::size_t size() const
+    {
+        return set.size();
+    }
+    // A point within tolerance of a stored one is merged, whichever that is.
+    void put(const Point & p)
+    {
+        const Point k = key(p);
+        if (tolerance > 0) {
+            if (auto nearest = set.nearest(k); nearest && k.distance(*nearest) <= tolerance) {
+                ++merges;
+                return;
+            }
+        }
+        set.put(k);
+    }
+    bool erase(const Point & p)
+    {
+        return set.erase(key(p));
+    }
+    bool contains(const Point & p) const
+    {
+        return set.contains(key(p));
+    }
+    auto range(const Rect & rect) const
+    {
+        return set.range(rect);
+    }
+    auto nearest(const Point & p, std::size_t k) const
+    {
+        return set.nearest(p, k);
+    }
+
+    std::size_t merges = 0;
+
+private:
+    double snap;
+    double tolerance;
+    bruteforce::PointSet set;
+};
+
+// Flips the sign of zero coordinates; the sets must not tell 0.0 and -0.0
+// apart.
+Point flip_zeros(const Point & p)
+{
+    return {p.x() == 0 ? -p.x() : p.x(), p.y() == 0 ? -p.y() : p.y()};
+}
+
+std::string describe(const std::vector<Point> & points)
+{
+    std::ostringstream out;
+    out << points.size() << " points";
+    for (std::size_t i = 0; i < points.size() && i < 5; ++i) {
+        out << ' ' << points[i];
+    }
+    return out.str();
+}
+
+template <class Set>
+void run(const Options & options, std::size_t index, Checker & checker, Timing & timing)
+{
+    const workload::Distribution distributions[] = {
+            workload::Distribution::Uniform,
+            workload::Distribution::Clusters,
+            workload::Distribution::Duplicates,
+            workload::Distribution::Collinear,
+            workload::Distribution::Sorted,
+            workload::Distribution::Roads,
+    };
+    std::uint64_t seed = options.seed * 1000003 + index;
+    std::mt19937_64 rng(seed);
+    workload::PointOptions point_options;
+    point_options.distribution = distributions[index % std::size(distributions)];
+    point_options.count = options.ops;
+    point_options.seed = seed;
+    std::vector<Point> pool = workload::generate_points(point_options);
+    // Every other run snaps to a coarse grid to provoke distance ties.
+    if (index % 2 == 1) {
+        for (auto & p : pool) {
+            p = Point(std::round(p.x() * 64) / 64, std::round(p.y() * 64) / 64);
+        }
+    }
+    // Some points on the axes, for signed zeros.
+    for (std::size_t i = 0; i < pool.size(); i += 8) {
+        pool[i] = i % 16 ? Point(pool[i].x(), 0.0) : Point(0.0, pool[i].y());
+    }
+
+    constexpr bool is_kdtree = std::is_same_v<Set, kdtree::PointSet>;
+    std::string mode = options.mode;
+    if (mode == "all") {
+        mode = is_kdtree ? mode_names[index / 2 % std::size(mode_names)] : "exact";
+    }
+    // A step that is not a power of two, so that snapping rounds.
+    const double snap = mode == "snap" ? (index % 2 ? 0.01 : 1.0 / 128) : 0;
+    // On the grid runs the tolerance is the grid step, so that points exactly
+    // at the tolerance are merged.
+    const double tolerance = mode == "merge" ? (index % 2 ? 1.0 / 64 : 0.5 / std::sqrt(static_cast<double>(options.ops))) : 0;
+    Set tree;
+    Reference brute(snap, tolerance);
+    std::size_t merges = 0;
+    if constexpr (is_kdtree) {
+        tree.set_snap(snap);
+        tree.set_merge_tolerance(tolerance, [&](const Point &, const Point &) { ++merges; });
+    }
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::size_t inserted = 0;
+    auto context = [&](const char * op) {
+        std::ostringstream out;
+        out << "run " << index << " (" << workload::name(point_options.distribution) << ", " << mode << ", seed " << seed << ") " << op << ": ";
+        return out.str();
+    };
+    auto pick = [&](std::size_t i) { return rng() % 2 ? flip_zeros(pool[i]) : pool[i]; };
+    auto random_rect = [&] {
+        const Point & c = pool[rng() % pool.size()];
+        double w = unit(rng) * 0.2, h = unit(rng) * 0.2;
+        if (rng() % 4 == 0) {
+            // Long thin rectangles cross cells without containing a corner.
+            (rng() % 2 ? w : h) = 2;
+        }
+        return Rect({c.x() - w, c.y() - h}, {c.x() + w, c.y() + h});
+    };
+
+    for (std::size_t step = 0; step < options.ops; ++step) {
+        if constexpr (is_kdtree) {
+            // The index is built from a filled set, kept up to date by
+            // put() and erase(), then dropped and rebuilt past tombstones.
+            if (mode == "hash" && (step == options.ops / 4 || step == options.ops * 3 / 4)) {
+                tree.set_hash_index(false);
+                tree.set_hash_index(true);
+            }
+        }
+        double roll = unit(rng);
+        Op op = inserted < pool.size() && (roll < 0.4 || brute.empty()) ? Put
+                : has_erase<Set>::value && roll < 0.5                     ? Erase
+                : roll < 0.65                                             ? Contains
+                : roll < (is_kdtree ? 0.75 : 0.8)                         ? Range
+                : roll < 0.8                                              ? MultiRange
+                                                                          : Nearest;
+        ++timing.count[op];
+        switch (op) {
+        case Put: {
+            const Point p = pick(rng() % 4 == 0 && inserted > 0 ? rng() % inserted : inserted++);
+            timing.kdtree_ns[op] += time_ns([&] { tree.put(p); });
+            timing.brute_ns[op] += time_ns([&] { brute.put(p); });
+            if (tree.size() != brute.size() || merges != brute.merges) {
+                std::ostringstream what;
+                what << context("put") << p << " size " << tree.size() << " != " << brute.size() << ", merges " << merges << " != " << brute.merges;
+                checker.fail(what.str());
+            }
+            // Snapped or not, a point just put is found again unless it was
+            // merged into another.
+            const bool found = brute.contains(p);
+            if (tree.contains(p) != found || tree.contains(flip_zeros(p)) != found) {
+                std::ostringstream what;
+                what << context("put") << p << " found after put " << tree.contains(p) << " != " << found;
+                checker.fail(what.str());
+            }
+            break;
+        }
+        case Erase: {
+            if constexpr (has_erase<Set>::value) {
+                // Half of the keys were put at some point, the rest maybe not.
+                const Point p = pick(rng() % 2 ? rng() % inserted : rng() % pool.size());
+                bool a = false, b = false;
+                timing.kdtree_ns[op] += time_ns([&] { a = tree.erase(p); });
+                timing.brute_ns[op] += time_ns([&] { b = brute.erase(p); });
+                if (a != b || tree.size() != brute.size()) {
+                    std::ostringstream what;
+                    what << context("erase") << p << ' ' << a << " != " << b << " size " << tree.size() << " != " << brute.size();
+                    checker.fail(what.str());
+                }
+            }
+            break;
+        }
+        case Contains: {
+            const Point p = pick(rng() % pool.size());
+            bool a = false, b = false;
+            timing.kdtree_ns[op] += time_ns([&] { a = tree.contains(p); });
+            timing.brute_ns[op] += time_ns([&] { b = brute.contains(p); });
+            if (a != b) {
+                std::ostringstream what;
+                what << context("contains") << p << ' ' << a << " != " << b;
+                checker.fail(what.str());
+            }
+            break;
+        }
+        case Range: {
+            Rect rect = random_rect();
+            std::vector<Point> a, b;
+            timing.kdtree_ns[op] += time_ns([&] { a = collect(tree.range(rect)); });
+            timing.brute_ns[op] += time_ns([&] { b = collect(brute.range(rect)); });
+            if (a != b) {
+                std::ostringstream what;
+                what << context("range") << rect.left_bottom() << '-' << rect.right_top() << ' ' << options.backend << ' ' << describe(a) << ", brute force " << describe(b);
+                checker.fail(what.str());
+            }
+            break;
+        }
+        case MultiRange: {
+            if constexpr (is_kdtree) {
+                // Up to the 64-rect limit, sometimes one past it.
+                const std::size_t count = rng() % 8 == 0 ? 64 + rng() % 2 : 1 + rng() % 16;
+                std::vector<Rect> rects;
+                for (std::size_t i = 0; i < count; ++i) {
+                    rects.push_back(random_rect());
+                }
+                std::vector<std::pair<Point, std::uint64_t>> a, b;
+                bool threw = false;
+                timing.kdtree_ns[op] += time_ns([&] {
+                    try {
+                        a = tree.range(rects);
+                    }
+                    catch (const std::length_error &) {
+                        threw = true;
+                    }
+                });
+                timing.brute_ns[op] += time_ns([&] {
+                    std::map<Point, std::uint64_t> masks;
+                    for (std::size_t i = 0; i < count && count <= 64; ++i) {
+                        auto range = brute.range(rects[i]);
+                        for (auto it = range.first; it != range.second; ++it) {
+                            masks[*it] |= std::uint64_t(1) << i;
+                        }
+                    }
+                    b.assign(masks.begin(), masks.end());
+                });
+                if (threw != (count > 64) || a != b) {
+                    std::ostringstream what;
+                    what << context("multirange") << count << " rects, " << (threw ? "threw" : "answered") << ", " << a.size()
+                         << " points != brute force " << b.size();
+                    checker.fail(what.str());
+                }
+            }
+            break;
+        }
+        case Nearest: {
+            Point key(unit(rng), unit(rng));
+            std::size_t k = 1 + rng() % 20;
+            std::vector<Point> a, b;
+            timing.kdtree_ns[op] += time_ns([&] { a = collect(tree.nearest(key, k)); });
+            timing.brute_ns[op] += time_ns([&] { b = collect(brute.nearest(key, k)); });
+            // Ties make the point sets ambiguous; the distances are not.
+            auto da = distances(a, key), db = distances(b, key);
+            bool same = da.size() == db.size();
+            for (std::size_t i = 0; same && i < da.size(); ++i) {
+                same = std::abs(da[i] - db[i]) <= 1e-12;
+            }
+            if (!same) {
+                std::ostringstream what;
+                what << context("nearest") << key << " k=" << k << ' ' << options.backend << ' ' << describe(a) << ", brute force " << describe(b);
+                checker.fail(what.str());
+            }
+            break;
+        }
+        case OpCount:
+            break;
+        }
+    }
+}
+
+// Point::operator==, the relational operators and LessXY against the
+// comparisons they must reduce to, over every pair of points drawn from
+// awkward coordinates. With POINT_APPROX_COMPARE the operators treat
+// coordinates closer than machine epsilon as equal; LessXY stays exact.
+void check_comparators(Checker & checker)
+{
+#ifdef POINT_APPROX_COMPARE
+    auto same = [](double x, double y) { return std::abs(x - y) < std::numeric_limits<double>::epsilon(); };
+#else
+    auto same = [](double x, double y) { return x == y; };
+#endif
+    auto less = [&](const Point & a, const Point & b) {
+        return same(a.x(), b.x()) ? !same(a.y(), b.y()) && a.y() < b.y() : a.x() < b.x();
+    };
+    const double values[] = {-INF, -1, -std::numeric_limits<double>::denorm_min(), -0.0, 0.0, std::numeric_limits<double>::denorm_min(),
+                             1e-300, 0.5, 1, std::nextafter(1.0, 2.0), INF};
+    std::vector<Point> points;
+    for (double x : values) {
+        for (double y : values) {
+            points.emplace_back(x, y);
+        }
+    }
+    for (const auto & a : points) {
+        for (const auto & b : points) {
+            const bool equal = same(a.x(), b.x()) && same(a.y(), b.y());
+            const bool exact_less = a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+            if ((a == b) != equal || (a != b) == equal || (a < b) != less(a, b) || LessXY()(a, b) != exact_less || (a > b) != less(b, a) ||
+                (a <= b) != !less(b, a) || (a >= b) != !less(a, b)) {
+                std::ostringstream what;
+                what << "comparators " << a << ' ' << b << ": == " << (a == b) << ", < " << (a < b) << ", LessXY " << LessXY()(a, b);
+                checker.fail(what.str());
+            }
+        }
+    }
+}
+
+// Fixed parser cases, each also parsed line by line the way the ingest
+// reader cuts blocks, which must not change the answer.
+void check_parser(Checker & checker)
+{
+    const std::pair<std::string, std::vector<Point>> cases[] = {
+            {"1 2\n3 4\n", {{1, 2}, {3, 4}}},
+            {"+1.5 2\n3 4", {{1.5, 2}, {3, 4}}},
+            {"-1 +2\n+-3 4\n++5 6\n7 8\n", {{-1, 2}, {7, 8}}},
+            {"1 x\n2 3\n", {{2, 3}}},
+            {"1 2 garbage 3\n4 5\n", {{4, 5}}},
+            {"1.0e1 2.5abc\n6 7\n", {{6, 7}}},
+            {"1 2 3\n4 5\n", {{1, 2}, {4, 5}}},
+            {"1\n2 3\n4", {{2, 3}}},
+            {"\t 1\t2 \r\n\n 2 1\r\n", {{1, 2}, {2, 1}}},
+            {"0 0\n-0 0\n0 0\n", {{0, 0}}},
+            {"nan 1\n1 inf\n-infinity 2\n1e999 3\n4 5\n", {{4, 5}}},
+    };
+    for (const auto & [text, expected] : cases) {
+        std::vector<Point> whole = ingest::parse_points(text.data(), text.data() + text.size());
+        std::vector<Point> lines;
+        for (std::size_t at = 0; at < text.size();) {
+            std::size_t eol = std::min(text.find('\n', at), text.size());
+            std::vector<Point> part = ingest::parse_points(text.data() + at, text.data() + eol);
+            lines.insert(lines.end(), part.begin(), part.end());
+            at = eol + 1;
+        }
+        std::sort(lines.begin(), lines.end(), LessXY());
+        lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+        if (whole != expected || lines != expected) {
+            std::ostringstream what;
+            what << "parse_points \"" << text << "\": " << describe(whole) << ", by lines " << describe(lines) << ", expected " << describe(expected);
+            checker.fail(what.str());
+        }
+    }
+}
+
+// sfc::Index::nearest against brute force, on a fixed case whose search
+// square used to round past a guessed point and on small random sets.
+void check_sfc(const Options & options, Checker & checker)
+{
+    std::vector<std::vector<Point>> sets = {{{0.4707521324902324, 0}, {0.074425040071166723, 0}}};
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    for (std::size_t i = 0; i < 50; ++i) {
+        std::vector<Point> points;
+        for (std::size_t n = rng() % 40 + 1; points.size() < n;) {
+            points.emplace_back(unit(rng), i % 2 ? 0.0 : unit(rng));
+        }
+        sets.push_back(points);
+    }
+    for (const auto & points : sets) {
+        bruteforce::PointSet brute;
+        for (const auto & p : points) {
+            brute.put(p);
+        }
+        for (sfc::Curve curve : {sfc::Curve::Morton, sfc::Curve::Hilbert}) {
+            sfc::Index index(points, curve, 1);
+            for (const auto & q : {points.front(), Point(unit(rng), unit(rng))}) {
+                for (std::size_t k = 1; k <= points.size() + 1; ++k) {
+                    std::vector<Point> got = index.nearest(q, k), expected = collect(brute.nearest(q, k));
+                    if (distances(got, q) != distances(expected, q)) {
+                        std::ostringstream what;
+                        what << "sfc nearest " << q << " k=" << k << " over " << describe(points) << ": " << describe(got) << ", brute force "
+                             << describe(expected);
+                        checker.fail(what.str());
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class Set, class F>
+double per_query(const Set & set, const std::vector<Point> & queries, F && query)
+{
+    volatile std::size_t sink = 0;
+    double ns = time_ns([&] {
+        for (const auto & q : queries) {
+            sink = sink + query(set, q);
+        }
+    });
+    return ns / queries.size();
+}
+
+template <class It>
+std::size_t count(std::pair<It, It> range)
+{
+    return std::distance(range.first, range.second);
+}
+
+template <class Set>
+void crossover(const Options & options)
+{
+    // The kdtree scans its points below flat_limit(); the sweep times it
+    // with no flat array at all, which is what the limit should be set
+    // from, and with the default limit.
+    constexpr bool is_kdtree = std::is_same_v<Set, kdtree::PointSet>;
+    const char * header = is_kdtree ? "tree / default / brute" : "tree / brute";
+    std::cout << "\ncrossover (ns/query, " << options.backend << ")\n"
+              << std::setw(8) << "n" << std::setw(30) << "contains" << std::setw(30) << "range 1%" << std::setw(30) << "nearest k=1" << '\n'
+              << std::setw(8) << "";
+    for (std::size_t i = 0; i < 3; ++i) {
+        std::cout << std::setw(30) << header;
+    }
+    std::cout << '\n';
+    workload::PointOptions query_options;
+    query_options.count = 2000;
+    query_options.seed = options.seed + 1;
+    std::vector<Point> queries = workload::generate_points(query_options);
+    std::size_t first_win[3] = {0, 0, 0};
+    for (std::size_t n = 8; n <= options.crossover; n *= 2) {
+        workload::PointOptions point_options;
+        point_options.count = n;
+        point_options.seed = options.seed + n;
+        std::vector<Point> points = workload::generate_points(point_options);
+        Set tree, tuned;
+        if constexpr (is_kdtree) {
+            tree.set_flat_limit(0);
+        }
+        bruteforce::PointSet brute;
+        for (const auto & p : points) {
+            tree.put(p);
+            if constexpr (is_kdtree) {
+                tuned.put(p);
+            }
+            brute.put(p);
+        }
+        auto contains = [](const auto & set, const Point & q) -> std::size_t { return set.contains(q); };
+        auto range = [](const auto & set, const Point & q) { return count(set.range(Rect({q.x() - 0.05, q.y() - 0.05}, {q.x() + 0.05, q.y() + 0.05}))); };
+        auto nearest = [](const auto & set, const Point & q) { return count(set.nearest(q, 1)); };
+        auto time_all = [&](const auto & query) {
+            return std::array<double, 3>{per_query(tree, queries, query), is_kdtree ? per_query(tuned, queries, query) : 0,
+                                         per_query(brute, queries, query)};
+        };
+        const std::array<double, 3> results[3] = {time_all(contains), time_all(range), time_all(nearest)};
+        std::cout << std::setw(8) << n;
+        for (std::size_t i = 0; i < 3; ++i) {
+            std::ostringstream cell;
+            cell << std::fixed << std::setprecision(1) << results[i][0] << " / ";
+            if (is_kdtree) {
+                cell << results[i][1] << " / ";
+            }
+            cell << results[i][2];
+            std::cout << std::setw(30) << cell.str();
+            if (first_win[i] == 0 && results[i][0] < results[i][2]) {
+                first_win[i] = n;
+            }
+        }
+        std::cout << '\n';
+    }
+    std::cout << options.backend << (is_kdtree ? " without a flat array" : "") << " first faster at n =";
+    for (std::size_t n : first_win) {
+        std::cout << ' ' << (n ? std::to_string(n) : "never");
+    }
+    std::cout << " (contains, range, nearest)\n";
+}
+
+Options parse(int argc, char ** argv)
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--mode") {
+            options.mode = argv[i + 1];
+            continue;
+        }
+        if (key == "--backend") {
+            options.backend = argv[i + 1];
+            if (options.backend != "kdtree" && options.backend != "quadtree") {
+                std::cerr << "unknown backend " << options.backend << '\n';
+                std::exit(2);
+            }
+            continue;
+        }
+        std::uint64_t value = std::stoull(argv[i + 1]);
+        if (key == "--runs") {
+            options.runs = value;
+        }
+        else if (key == "--ops") {
+            options.ops = value;
+        }
+        else if (key == "--seed") {
+            options.seed = value;
+        }
+        else if (key == "--crossover") {
+            options.crossover = value;
+        }
+        else {
+            std::cerr << "unknown option " << key << '\n';
+            std::exit(2);
+        }
+    }
+    if (options.mode != "all" && std::find(std::begin(mode_names), std::end(mode_names), options.mode) == std::end(mode_names)) {
+        std::cerr << "unknown mode " << options.mode << '\n';
+        std::exit(2);
+    }
+    if (options.backend != "kdtree" && options.mode != "all" && options.mode != "exact") {
+        std::cerr << "mode " << options.mode << " needs the kdtree backend\n";
+        std::exit(2);
+    }
+    return options;
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    Options options = parse(argc, argv);
+    Checker checker(options);
+    Timing timing;
+    check_parser(checker);
+    check_comparators(checker);
+    check_sfc(options, checker);
+    for (std::size_t i = 0; i < options.runs; ++i) {
+        if (options.backend == "quadtree") {
+            run<quadtree::PointSet>(options, i, checker, timing);
+        }
+        else {
+            run<kdtree::PointSet>(options, i, checker, timing);
+        }
+    }
+    std::cout << std::fixed << std::setprecision(1) << std::setw(10) << "op" << std::setw(10) << "count" << std::setw(16) << options.backend + " ns/op"
+              << std::setw(16) << "brute ns/op" << '\n';
+    for (int op = 0; op < OpCount; ++op) {
+        std::size_t n = std::max<std::size_t>(timing.count[op], 1);
+        std::cout << std::setw(10) << op_names[op] << std::setw(10) << timing.count[op] << std::setw(16) << timing.kdtree_ns[op] / n
+                  << std::setw(16) << timing.brute_ns[op] / n << '\n';
+    }
+    if (options.crossover != 0) {
+        if (options.backend == "quadtree") {
+            crossover<quadtree::PointSet>(options);
+        }
+        else {
+            crossover<kdtree::PointSet>(options);
+        }
+    }
+    std::cout << (checker.failures ? "FAILED: " : "OK: ") << checker.failures << " mismatches\n";
+    return checker.failures ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+#include "../flattree.h"
+#include "workload.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Flat tree benchmark: flattree::Tree against the kdtree::PointSet it is
+ * built from. Times single contains / nearest / range, the interleaved
+ * batch queries and the packet mode, on random keys (half of them hits)
+ * and on a random walk, where neighbouring keys are close. Every answer is
+ * checked against the PointSet; nearest is compared by distance, since
+ * ties may pick different points.
+ *
+ *   g++ -std=c++17 -O2 -DNDEBUG -march=native bench/flatbench.cpp bench/workload.cpp flattree.cpp 2dtree.cpp ingest.cpp -pthread -o flatbench
+ *   ./flatbench [--count N] [--queries Q] [--dist uniform] [--group G] [--seed S]
+ *
+ * Exits with status 1 if any answer differs.
+ */
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+template <class F>
+double per_query(std::size_t queries, F && body)
+{
+    auto start = clock_type::now();
+    body();
+    std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+    return elapsed.count() / static_cast<double>(queries);
+}
+
+class Checker
+{
+public:
+    void expect(bool ok, const std::string & what)
+    {
+        if (!ok && failures++ < 10) {
+            std::cerr << "MISMATCH " << what << '\n';
+        }
+    }
+
+    std::size_t failures = 0;
+};
+
+void report(const char * keys, const char * op, double pointset, const std::vector<std::pair<const char *, double>> & flat)
+{
+    std::cout << std::left << std::setw(8) << keys << std::setw(10) << op << std::right << std::fixed << std::setprecision(1) << "pointset "
+              << std::setw(8) << pointset << " ns";
+    for (const auto & [name, ns] : flat) {
+        std::cout << ", " << name << ' ' << std::setw(8) << ns << " ns";
+    }
+    std::cout << '\n';
+}
+
+bool same_distance(const Point & key, const std::optional<Point> & a, const std::optional<Point> & b)
+{
+    return a.has_value() == b.has_value() && (!a || key.distance(*a) == key.distance(*b));
+}
+
+void run(const char * name, const kdtree::PointSet & set, const flattree::Tree & tree, const std::vector<Point> & keys, std::size_t group, Checker & checker)
+{
+    const std::size_t n = keys.size();
+    const flattree::BatchOptions interleaved{flattree::BatchOptions::Mode::Interleaved, group};
+    const flattree::BatchOptions packet{flattree::BatchOptions::Mode::Packet, group};
+
+    std::vector<bool> expected(n), single(n), batch, packed;
+    double pointset = per_query(n, [&] {
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = set.contains(keys[i]);
+        }
+    });
+    double flat = per_query(n, [&] {
+        for (std::size_t i = 0; i < n; ++i) {
+            single[i] = tree.contains(keys[i]);
+        }
+    });
+    double interleaved_ns = per_query(n, [&] { batch = tree.contains(keys, interleaved); });
+    double packet_ns = per_query(n, [&] { packed = tree.contains(keys, packet); });
+    report(name, "contains", pointset, {{"single", flat}, {"interleaved", interleaved_ns}, {"packet", packet_ns}});
+    for (std::size_t i = 0; i < n; ++i) {
+        checker.expect(single[i] == expected[i] && batch[i] == expected[i] && packed[i] == expected[i],
+                       std::string(name) + " contains at " + std::to_string(i));
+    }
+
+    std::vector<std::optional<Point>> expected_nearest(n), single_nearest(n), batch_nearest, packed_nearest;
+    pointset = per_query(n, [&] {
+        for (std::size_t i = 0; i < n; ++i) {
+            expected_nearest[i] = set.nearest(keys[i]);
+        }
+    });
+    flat = per_query(n, [&] {
+        for (std::size_t i = 0; i < n; ++i) {
+            single_nearest[i] = tree.nearest(keys[i]);
+        }
+    });
+    interleaved_ns = per_query(n, [&] { batch_nearest = tree.nearest(keys, interleaved); });
+    packet_ns = per_query(n, [&] { packed_nearest = tree.nearest(keys, packet); });
+    report(name, "nearest", pointset, {{"single", flat}, {"interleaved", interleaved_ns}, {"packet", packet_ns}});
+    for (std::size_t i = 0; i < n; ++i) {
+        checker.expect(same_distance(keys[i], expected_nearest[i], single_nearest[i]) && same_distance(keys[i], expected_nearest[i], batch_nearest[i]) &&
+                               same_distance(keys[i], expected_nearest[i], packed_nearest[i]),
+                       std::string(name) + " nearest at " + std::to_string(i));
+    }
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::size_t count = 1 << 20, queries = 1 << 18, group = flattree::BatchOptions().group;
+    workload::Distribution distribution = workload::Distribution::Uniform;
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--count")) {
+            count = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--queries")) {
+            queries = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--group")) {
+            group = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--seed")) {
+            seed = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+        else if (!std::strcmp(argv[i], "--dist")) {
+            auto parsed = workload::parse_distribution(argv[i + 1]);
+            if (!parsed) {
+                std::cerr << "unknown distribution " << argv[i + 1] << '\n';
+                return 2;
+            }
+            distribution = *parsed;
+        }
+    }
+
+    workload::PointOptions point_options;
+    point_options.distribution = distribution;
+    point_options.count = count;
+    point_options.seed = seed;
+    std::vector<Point> points = workload::generate_points(point_options);
+    auto start = clock_type::now();
+    kdtree::PointSet set(points);
+    std::chrono::duration<double, std::milli> set_ms = clock_type::now() - start;
+    start = clock_type::now();
+    flattree::Tree tree(set);
+    std::chrono::duration<double, std::milli> tree_ms = clock_type::now() - start;
+    std::cout << tree.size() << " points (" << workload::name(distribution) << "): pointset built in " << set_ms.count() << " ms, flat tree in "
+              << tree_ms.count() << " ms, " << tree.memory_bytes() / tree.size() << " bytes per point\n";
+
+    Checker checker;
+    checker.expect(tree.size() == set.size(), "size " + std::to_string(tree.size()) + " != " + std::to_string(set.size()));
+
+    std::mt19937_64 rng(seed + 1);
+    std::uniform_real_distribution<double> unit(0, 1);
+    Rect box = workload::bounds(points);
+    auto inside = [&](double u, double v) { return Point(box.xmin() + u * (box.xmax() - box.xmin()), box.ymin() + v * (box.ymax() - box.ymin())); };
+    std::vector<Point> random_keys, walk;
+    for (std::size_t i = 0; i < queries; ++i) {
+        random_keys.push_back(i % 2 == 0 ? points[rng() % points.size()] : inside(unit(rng), unit(rng)));
+    }
+    // A random walk with steps of about the point spacing; every fourth key
+    // is a stored point, so packets mix hits and misses.
+    double u = unit(rng), v = unit(rng), step = 1 / std::sqrt(static_cast<double>(count));
+    for (std::size_t i = 0; i < queries; ++i) {
+        u = std::min(1.0, std::max(0.0, u + (unit(rng) - 0.5) * step));
+        v = std::min(1.0, std::max(0.0, v + (unit(rng) - 0.5) * step));
+        walk.push_back(i % 4 == 3 ? set.nearest(inside(u, v)).value_or(inside(u, v)) : inside(u, v));
+    }
+    run("random", set, tree, random_keys, group, checker);
+    run("walk", set, tree, walk, group, checker);
+
+    // Range: a few thousand windows of about 100 points each.
+    const std::size_t windows = std::min<std::size_t>(queries, 2000);
+    const double side = std::sqrt(100.0 / static_cast<double>(count));
+    std::vector<Rect> rects;
+    for (std::size_t i = 0; i < windows; ++i) {
+        Point c = inside(unit(rng), unit(rng));
+        double w = side * (box.xmax() - box.xmin()) / 2, h = side * (box.ymax() - box.ymin()) / 2;
+        rects.push_back(Rect({c.x() - w, c.y() - h}, {c.x() + w, c.y() + h}));
+    }
+    std::vector<std::vector<Point>> expected(windows), got(windows);
+    double pointset = per_query(windows, [&] {
+        for (std::size_t i = 0; i < windows; ++i) {
+            auto range = set.range(rects[i]);
+            expected[i].assign(range.first, range.second);
+        }
+    });
+    double flat = per_query(windows, [&] {
+        for (std::size_t i = 0; i < windows; ++i) {
+            got[i] = tree.range(rects[i]);
+        }
+    });
+    report("random", "range", pointset, {{"single", flat}});
+    for (std::size_t i = 0; i < windows; ++i) {
+        std::sort(expected[i].begin(), expected[i].end());
+        std::sort(got[i].begin(), got[i].end());
+        checker.expect(expected[i] == got[i], "range " + std::to_string(i));
+    }
+
+    std::cout << (checker.failures ? "FAILED: " : "OK: ") << checker.failures << " mismatches\n";
+    return checker.failures ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+#include "workload.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+/*
+ * Workload generator.
+ *
+ *   g++ -std=c++17 -O2 bench/gen.cpp bench/workload.cpp -o pointgen
+ *   ./pointgen points --dist clusters --count 1000000 --seed 7 --out points.txt
+ *   ./pointgen queries --points points.txt --count 10000 --skew 1.1 --out queries.txt
+ */
+
+namespace {
+int usage()
+{
+    std::cerr << "usage: pointgen points [--dist uniform|clusters|roads|duplicates|collinear|sorted] [--count N] [--seed S]\n"
+                 "                       [--bounds xmin,ymin,xmax,ymax] [--clusters N] [--sigma S] [--roads N]\n"
+                 "                       [--duplicates F] [--out FILE]\n"
+                 "       pointgen queries --points FILE [--count N] [--seed S] [--mix contains,range,nearest]\n"
+                 "                        [--hit-rate F] [--selectivity MIN,MAX] [--k MIN,MAX] [--hotspots N]\n"
+                 "                        [--skew S] [--out FILE]\n";
+    return 1;
+}
+
+std::vector<double> numbers(const std::string & list)
+{
+    std::vector<double> result;
+    std::size_t pos = 0;
+    while (pos <= list.size()) {
+        std::size_t comma = list.find(',', pos);
+        result.push_back(std::stod(list.substr(pos, comma - pos)));
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+    return result;
+}
+
+template <class F>
+int with_output(const std::map<std::string, std::string> & args, F && write)
+{
+    auto out = args.find("--out");
+    if (out == args.end()) {
+        write(std::cout);
+        return 0;
+    }
+    std::ofstream file(out->second);
+    if (!file) {
+        std::cerr << "cannot open " << out->second << '\n';
+        return 1;
+    }
+    write(file);
+    return 0;
+}
+
+int points(const std::map<std::string, std::string> & args)
+{
+    workload::PointOptions options;
+    for (const auto & [key, value] : args) {
+        if (key == "--dist") {
+            auto distribution = workload::parse_distribution(value);
+            if (!distribution) {
+                return usage();
+            }
+            options.distribution = *distribution;
+        }
+        else if (key == "--count") {
+            options.count = std::stoull(value);
+        }
+        else if (key == "--seed") {
+            options.seed = std::stoull(value);
+        }
+        else if (key == "--bounds") {
+            auto b = numbers(value);
+            if (b.size() != 4) {
+                return usage();
+            }
+            options.bounds = Rect({b[0], b[1]}, {b[2], b[3]});
+        }
+        else if (key == "--clusters") {
+            options.clusters = std::stoull(value);
+        }
+        else if (key == "--sigma") {
+            options.cluster_sigma = std::stod(value);
+        }
+        else if (key == "--roads") {
+            options.roads = std::stoull(value);
+        }
+        else if (key == "--duplicates") {
+            options.duplicate_fraction = std::stod(value);
+        }
+        else if (key != "--out") {
+            return usage();
+        }
+    }
+    auto generated = workload::generate_points(options);
+    return with_output(args, [&](std::ostream & out) { workload::write_points(out, generated); });
+}
+
+int queries(const std::map<std::string, std::string> & args)
+{
+    workload::QueryOptions options;
+    std::vector<Point> data;
+    for (const auto & [key, value] : args) {
+        if (key == "--points") {
+            std::ifstream in(value);
+            data = workload::read_points(in);
+        }
+        else if (key == "--count") {
+            options.count = std::stoull(value);
+        }
+        else if (key == "--seed") {
+            options.seed = std::stoull(value);
+        }
+        else if (key == "--mix") {
+            auto mix = numbers(value);
+            if (mix.size() != 3) {
+                return usage();
+            }
+            options.contains_share = mix[0];
+            options.range_share = mix[1];
+            options.nearest_share = mix[2];
+        }
+        else if (key == "--hit-rate") {
+            options.hit_rate = std::stod(value);
+        }
+        else if (key == "--selectivity") {
+            auto s = numbers(value);
+            if (s.size() != 2) {
+                return usage();
+            }
+            options.min_selectivity = s[0];
+            options.max_selectivity = s[1];
+        }
+        else if (key == "--k") {
+            auto k = numbers(value);
+            if (k.size() != 2) {
+                return usage();
+            }
+            options.min_k = static_cast<std::size_t>(k[0]);
+            options.max_k = static_cast<std::size_t>(k[1]);
+        }
+        else if (key == "--hotspots") {
+            options.hotspots = std::stoull(value);
+        }
+        else if (key == "--skew") {
+            options.skew = std::stod(value);
+        }
+        else if (key != "--out") {
+            return usage();
+        }
+    }
+    if (data.empty()) {
+        std::cerr << "--points must name a non-empty point file\n";
+        return 1;
+    }
+    auto generated = workload::generate_queries(data, options);
+    return with_output(args, [&](std::ostream & out) { workload::write_queries(out, generated); });
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2 || argc % 2 != 0) {
+        return usage();
+    }
+    std::map<std::string, std::string> args;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        args[argv[i]] = argv[i + 1];
+    }
+    std::string command = argv[1];
+    if (command == "points") {
+        return points(args);
+    }
+    if (command == "queries") {
+        return queries(args);
+    }
+    return usage();
+}
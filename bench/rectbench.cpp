@@ -0,0 +1,112 @@
+#include "../rectbatch.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Rect primitive benchmark: one query rect against N points or rects, as a
+ * loop over Rect::contains / Rect::intersects / Rect::distance and as the
+ * SoA batch kernels. Prints nanoseconds per element.
+ *
+ *   g++ -std=c++17 -O2 -DNDEBUG -march=native bench/rectbench.cpp rectbatch.cpp -o rectbench
+ *   ./rectbench [--count N] [--queries Q] [--seed S]
+ */
+
+namespace {
+template <class F>
+double per_element(std::size_t elements, std::size_t queries, F && body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t q = 0; q < queries; ++q) {
+        body(q);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(elements * queries);
+}
+
+void report(const char * name, double scalar, double batch, std::size_t check_scalar, std::size_t check_batch)
+{
+    std::cout << name << ": scalar " << scalar << " ns, batch " << batch << " ns, speedup " << scalar / batch;
+    if (check_scalar != check_batch) {
+        std::cout << "  MISMATCH " << check_scalar << " vs " << check_batch;
+    }
+    std::cout << '\n';
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::size_t count = 1 << 16, queries = 1000;
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--count")) {
+            count = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--queries")) {
+            queries = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--seed")) {
+            seed = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+        }
+    }
+
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::vector<double> xs(count), ys(count), x1(count), y1(count);
+    std::vector<Point> points;
+    std::vector<Rect> rects;
+    for (std::size_t i = 0; i < count; ++i) {
+        xs[i] = unit(rng);
+        ys[i] = unit(rng);
+        x1[i] = xs[i] + unit(rng) * 0.05;
+        y1[i] = ys[i] + unit(rng) * 0.05;
+        points.emplace_back(xs[i], ys[i]);
+        rects.push_back({{xs[i], ys[i]}, {x1[i], y1[i]}});
+    }
+    std::vector<Rect> windows;
+    for (std::size_t q = 0; q < queries; ++q) {
+        double x = unit(rng), y = unit(rng), half = unit(rng) * 0.25;
+        windows.push_back({{x - half, y - half}, {x + half, y + half}});
+    }
+    std::vector<std::uint32_t> hits(count);
+    std::vector<double> distances(count);
+    std::size_t a = 0, b = 0;
+
+    double scalar = per_element(count, queries, [&](std::size_t q) {
+        for (std::size_t i = 0; i < count; ++i) {
+            hits[a % count] = static_cast<std::uint32_t>(i);
+            a += windows[q].contains(points[i]);
+        }
+    });
+    double batch = per_element(count, queries, [&](std::size_t q) { b += rectbatch::contains(windows[q], {xs.data(), ys.data(), count}, hits.data()); });
+    report("contains  ", scalar, batch, a, b);
+
+    a = b = 0;
+    scalar = per_element(count, queries, [&](std::size_t q) {
+        for (std::size_t i = 0; i < count; ++i) {
+            hits[a % count] = static_cast<std::uint32_t>(i);
+            a += windows[q].intersects(rects[i]);
+        }
+    });
+    batch = per_element(count, queries, [&](std::size_t q) { b += rectbatch::intersects(windows[q], {xs.data(), ys.data(), x1.data(), y1.data(), count}, hits.data()); });
+    report("intersects", scalar, batch, a, b);
+
+    double sum_scalar = 0, sum_batch = 0;
+    scalar = per_element(count, queries, [&](std::size_t q) {
+        for (std::size_t i = 0; i < count; ++i) {
+            distances[i] = windows[q].distance(points[i]);
+        }
+        sum_scalar += distances[q % count];
+    });
+    batch = per_element(count, queries, [&](std::size_t q) {
+        rectbatch::distance(windows[q], {xs.data(), ys.data(), count}, distances.data());
+        sum_batch += distances[q % count];
+    });
+    report("distance  ", scalar, batch, static_cast<std::size_t>(sum_scalar * 1e6), static_cast<std::size_t>(sum_batch * 1e6));
+    return 0;
+}
@@ -0,0 +1,313 @@
+#include "../wal.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Crash test for wal::DurableSet. Every round forks a child that opens the
+ * directory and applies a seeded sequence of put/erase operations, telling
+ * the parent through a pipe how far it got and how much of that is known to
+ * be durable. The child then dies without cleaning up, by _exit() at a
+ * random operation or by SIGKILL from the parent at a random time, with
+ * checkpoints and log rotations going on. The parent reopens the directory
+ * and checks that the recovered set equals the state after some prefix of
+ * the operations, no shorter than the durable part. A final round appends
+ * garbage to the newest log and checks that it is cut off as a torn tail,
+ * and that the same garbage in an older log makes recovery fail.
+ *
+ *   g++ -std=c++17 -O2 bench/walcrash.cpp wal.cpp 2dtree.cpp ingest.cpp -pthread -o walcrash
+ *   ./walcrash --rounds 30 --ops 3000 --seed 1 [--dir /tmp/walcrash]
+ *
+ * Exits with status 1 if a recovered state is not a valid prefix.
+ */
+
+namespace {
+
+struct Options
+{
+    std::size_t rounds = 30;
+    std::size_t ops = 3000;
+    std::uint64_t seed = 1;
+    std::string directory;
+};
+
+struct Step
+{
+    bool erase;
+    Point point;
+};
+
+struct Progress
+{
+    std::uint32_t done;
+    std::uint32_t durable;
+};
+
+std::vector<Step> make_steps(std::uint64_t seed, std::size_t count)
+{
+    // A small grid, so that erases and repeated puts hit.
+    std::mt19937_64 rng(seed);
+    std::vector<Step> steps;
+    for (std::size_t i = 0; i < count; ++i) {
+        steps.push_back({rng() % 4 == 0, Point(static_cast<double>(rng() % 64), static_cast<double>(rng() % 64))});
+    }
+    return steps;
+}
+
+void apply(std::set<Point> & set, const Step & step)
+{
+    if (step.erase) {
+        set.erase(step.point);
+    }
+    else {
+        set.insert(step.point);
+    }
+}
+
+std::set<Point> recover(const std::string & directory, wal::RecoveryStats * stats = nullptr)
+{
+    wal::DurableSet set(directory);
+    if (stats != nullptr) {
+        *stats = set.recovery();
+    }
+    return {set.points().begin(), set.points().end()};
+}
+
+[[noreturn]] void child(const std::string & directory, const std::vector<Step> & steps, bool wait_for_sync, std::size_t exit_at, int fd)
+{
+    wal::Options options;
+    options.wait_for_sync = wait_for_sync;
+    options.checkpoint_bytes = 4096;
+    // Never destroyed: the process dies with the set open.
+    auto * set = new wal::DurableSet(directory, options);
+    Progress progress{0, 0};
+    for (const auto & step : steps) {
+        if (progress.done == exit_at) {
+            _exit(0);
+        }
+        if (step.erase) {
+            set->erase(step.point);
+        }
+        else {
+            set->put(step.point);
+        }
+        ++progress.done;
+        if (wait_for_sync) {
+            progress.durable = progress.done;
+        }
+        else if (progress.done % 100 == 0) {
+            set->sync();
+            progress.durable = progress.done;
+        }
+        if (progress.done % 500 == 0) {
+            set->checkpoint();
+        }
+        if (::write(fd, &progress, sizeof(progress)) != sizeof(progress)) {
+            _exit(2);
+        }
+    }
+    _exit(0);
+}
+
+std::string newest_log(const std::string & directory)
+{
+    std::string newest;
+    unsigned long long generation = 0;
+    if (DIR * dir = ::opendir(directory.c_str())) {
+        while (dirent * entry = ::readdir(dir)) {
+            if (std::strncmp(entry->d_name, "wal.", 4) == 0 && entry->d_name[4] != '\0') {
+                unsigned long long g = std::strtoull(entry->d_name + 4, nullptr, 10);
+                if (newest.empty() || g > generation) {
+                    generation = g;
+                    newest = directory + '/' + entry->d_name;
+                }
+            }
+        }
+        ::closedir(dir);
+    }
+    return newest;
+}
+
+void remove_directory(const std::string & directory)
+{
+    if (DIR * dir = ::opendir(directory.c_str())) {
+        while (dirent * entry = ::readdir(dir)) {
+            if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                ::unlink((directory + '/' + entry->d_name).c_str());
+            }
+        }
+        ::closedir(dir);
+    }
+    ::rmdir(directory.c_str());
+}
+
+Options parse(int argc, char ** argv)
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--dir") {
+            options.directory = argv[i + 1];
+            continue;
+        }
+        std::uint64_t value = std::stoull(argv[i + 1]);
+        if (key == "--rounds") {
+            options.rounds = value;
+        }
+        else if (key == "--ops") {
+            options.ops = value;
+        }
+        else if (key == "--seed") {
+            options.seed = value;
+        }
+        else {
+            std::cerr << "unknown option " << key << '\n';
+            std::exit(2);
+        }
+    }
+    return options;
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    Options options = parse(argc, argv);
+    bool temporary = options.directory.empty();
+    if (temporary) {
+        char name[] = "/tmp/walcrash.XXXXXX";
+        if (::mkdtemp(name) == nullptr) {
+            std::cerr << "cannot create a temporary directory\n";
+            return 2;
+        }
+        options.directory = name;
+    }
+    std::mt19937_64 rng(options.seed);
+    std::set<Point> state = recover(options.directory);
+    std::size_t failures = 0;
+
+    for (std::size_t round = 0; round < options.rounds; ++round) {
+        const std::vector<Step> steps = make_steps(options.seed * 1000003 + round, options.ops);
+        // Round kinds: acknowledged writes and _exit, group commit without
+        // waiting and _exit, acknowledged writes and SIGKILL.
+        const int kind = round % 3;
+        const std::size_t exit_at = kind == 2 ? steps.size() : rng() % (steps.size() + 1);
+        int pipe_fds[2];
+        if (::pipe(pipe_fds) != 0) {
+            std::cerr << "pipe failed\n";
+            return 2;
+        }
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            ::close(pipe_fds[0]);
+            child(options.directory, steps, kind != 1, exit_at, pipe_fds[1]);
+        }
+        ::close(pipe_fds[1]);
+        if (kind == 2) {
+            ::usleep(static_cast<useconds_t>(rng() % 200000));
+            ::kill(pid, SIGKILL);
+        }
+        Progress last{0, 0}, progress;
+        while (::read(pipe_fds[0], &progress, sizeof(progress)) == sizeof(progress)) {
+            last = progress;
+        }
+        ::close(pipe_fds[0]);
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+
+        wal::RecoveryStats stats;
+        const std::set<Point> recovered = recover(options.directory, &stats);
+        // The operation in flight when the child died may or may not have
+        // reached the disk.
+        const std::size_t hi = std::min<std::size_t>(last.done + 1, steps.size());
+        std::set<Point> expected = state;
+        std::size_t matched = steps.size() + 1;
+        for (std::size_t i = 0; i <= hi; ++i) {
+            if (i >= last.durable && expected == recovered) {
+                matched = i;
+                break;
+            }
+            if (i < steps.size()) {
+                apply(expected, steps[i]);
+            }
+        }
+        std::cout << "round " << round << (kind == 0 ? " exit" : kind == 1 ? " async exit" : " kill") << ": done " << last.done
+                  << ", durable " << last.durable << ", recovered " << recovered.size() << " points (" << stats << ")";
+        if (matched > steps.size()) {
+            ++failures;
+            std::cout << " MISMATCH: not the state after any of operations " << last.durable << ".." << hi << '\n';
+        }
+        else {
+            std::cout << " = after " << matched << '\n';
+        }
+        state = recovered;
+    }
+
+    // A torn tail: garbage after the last record is cut off on open.
+    {
+        wal::DurableSet set(options.directory);
+        set.put(Point(-1, -1));
+        state.insert(Point(-1, -1));
+    }
+    const std::string log = newest_log(options.directory);
+    const char garbage[] = "torn tail";
+    int fd = ::open(log.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0 || ::write(fd, garbage, sizeof(garbage)) != sizeof(garbage)) {
+        std::cerr << "cannot append to " << log << '\n';
+        return 2;
+    }
+    ::close(fd);
+    wal::RecoveryStats stats;
+    if (recover(options.directory, &stats) != state || stats.torn_bytes != sizeof(garbage)) {
+        ++failures;
+        std::cout << "torn tail MISMATCH (" << stats << ")\n";
+    }
+    else if (recover(options.directory, &stats) != state || stats.torn_bytes != 0) {
+        ++failures;
+        std::cout << "torn tail not truncated (" << stats << ")\n";
+    }
+
+    // The same garbage in a log that is not the newest is corruption:
+    // recovery must refuse to open rather than cut the log and go on.
+    fd = ::open(log.c_str(), O_WRONLY | O_APPEND);
+    const std::string next = log.substr(0, log.rfind('.') + 1) + std::to_string(std::stoull(log.substr(log.rfind('.') + 1)) + 1);
+    struct
+    {
+        char magic[8];
+        std::uint64_t generation;
+    } header = {{'P', 'S', 'W', 'A', 'L', '0', '0', '1'}, std::stoull(next.substr(next.rfind('.') + 1))};
+    int next_fd = ::open(next.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || next_fd < 0 || ::write(fd, garbage, sizeof(garbage)) != sizeof(garbage) ||
+        ::write(next_fd, &header, sizeof(header)) != sizeof(header)) {
+        std::cerr << "cannot write " << log << " or " << next << '\n';
+        return 2;
+    }
+    ::close(fd);
+    ::close(next_fd);
+    try {
+        recover(options.directory);
+        ++failures;
+        std::cout << "corrupt older log MISMATCH: opened\n";
+    }
+    catch (const std::runtime_error &) {
+    }
+    ::unlink(next.c_str());
+
+    if (temporary) {
+        remove_directory(options.directory);
+    }
+    std::cout << (failures ? "FAILED: " : "OK: ") << failures << " mismatches\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,280 @@
+#include "workload.h"
+
+#include <cmath>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <random>
+
+namespace workload {
+
+namespace {
+const char * const names[] = {"uniform", "clusters", "roads", "duplicates", "collinear", "sorted"};
+
+Point lerp(const Rect & rect, double u, double v)
+{
+    return {rect.xmin() + u * (rect.xmax() - rect.xmin()), rect.ymin() + v * (rect.ymax() - rect.ymin())};
+}
+
+void uniform(const PointOptions & options, std::mt19937_64 & rng, std::vector<Point> & points)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    for (std::size_t i = 0; i < options.count; ++i) {
+        double u = unit(rng);
+        points.push_back(lerp(options.bounds, u, unit(rng)));
+    }
+}
+
+void clusters(const PointOptions & options, std::mt19937_64 & rng, std::vector<Point> & points)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<std::pair<double, double>> centers;
+    for (std::size_t i = 0; i < std::max<std::size_t>(options.clusters, 1); ++i) {
+        double u = unit(rng);
+        centers.emplace_back(u, unit(rng));
+    }
+    std::normal_distribution<double> noise(0.0, options.cluster_sigma);
+    std::uniform_int_distribution<std::size_t> pick(0, centers.size() - 1);
+    for (std::size_t i = 0; i < options.count; ++i) {
+        auto [u, v] = centers[pick(rng)];
+        double du = noise(rng);
+        points.push_back(lerp(options.bounds, u + du, v + noise(rng)));
+    }
+}
+
+void roads(const PointOptions & options, std::mt19937_64 & rng, std::vector<Point> & points)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> turn(0.0, 0.3);
+    std::normal_distribution<double> noise(0.0, options.road_noise);
+    std::size_t roads = std::max<std::size_t>(options.roads, 1);
+    std::size_t per_road = (options.count + roads - 1) / roads;
+    for (std::size_t r = 0; r < roads && points.size() < options.count; ++r) {
+        double u = unit(rng), v = unit(rng);
+        double heading = unit(rng) * 2 * M_PI;
+        double step = 0.5 / per_road;
+        for (std::size_t i = 0; i < per_road && points.size() < options.count; ++i) {
+            if (i % 16 == 0) {
+                heading += turn(rng);
+            }
+            u += step * std::cos(heading);
+            v += step * std::sin(heading);
+            // Bounce off the bounds so roads stay inside them.
+            if (u < 0 || u > 1) {
+                heading = M_PI - heading;
+                u = std::clamp(u, 0.0, 1.0);
+            }
+            if (v < 0 || v > 1) {
+                heading = -heading;
+                v = std::clamp(v, 0.0, 1.0);
+            }
+            double du = noise(rng);
+            points.push_back(lerp(options.bounds, u + du, v + noise(rng)));
+        }
+    }
+}
+
+void duplicates(const PointOptions & options, std::mt19937_64 & rng, std::vector<Point> & points)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    for (std::size_t i = 0; i < options.count; ++i) {
+        if (!points.empty() && unit(rng) < options.duplicate_fraction) {
+            points.push_back(points[rng() % points.size()]);
+        }
+        else {
+            double u = unit(rng);
+            points.push_back(lerp(options.bounds, u, unit(rng)));
+        }
+    }
+}
+
+void collinear(const PointOptions & options, std::mt19937_64 & rng, std::vector<Point> & points)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    double u0 = unit(rng), v0 = unit(rng);
+    double u1 = unit(rng), v1 = unit(rng);
+    for (std::size_t i = 0; i < options.count; ++i) {
+        double t = unit(rng);
+        points.push_back(lerp(options.bounds, u0 + t * (u1 - u0), v0 + t * (v1 - v0)));
+    }
+}
+
+double log_uniform(std::mt19937_64 & rng, double lo, double hi)
+{
+    std::uniform_real_distribution<double> dist(std::log(lo), std::log(hi));
+    return std::exp(dist(rng));
+}
+} // namespace
+
+const char * name(Distribution distribution)
+{
+    return names[static_cast<int>(distribution)];
+}
+
+std::optional<Distribution> parse_distribution(const std::string & value)
+{
+    for (int i = 0; i < static_cast<int>(std::size(names)); ++i) {
+        if (value == names[i]) {
+            return static_cast<Distribution>(i);
+        }
+    }
+    return {};
+}
+
+std::vector<Point> generate_points(const PointOptions & options)
+{
+    std::mt19937_64 rng(options.seed);
+    std::vector<Point> points;
+    points.reserve(options.count);
+    switch (options.distribution) {
+    case Distribution::Uniform:
+    case Distribution::Sorted:
+        uniform(options, rng, points);
+        break;
+    case Distribution::Clusters:
+        clusters(options, rng, points);
+        break;
+    case Distribution::Roads:
+        roads(options, rng, points);
+        break;
+    case Distribution::Duplicates:
+        duplicates(options, rng, points);
+        break;
+    case Distribution::Collinear:
+        collinear(options, rng, points);
+        break;
+    }
+    if (options.distribution == Distribution::Sorted) {
+        std::sort(points.begin(), points.end());
+    }
+    return points;
+}
+
+Rect bounds(const std::vector<Point> & points)
+{
+    if (points.empty()) {
+        return {};
+    }
+    double xmin = INF, ymin = INF, xmax = -INF, ymax = -INF;
+    for (const auto & p : points) {
+        xmin = std::min(xmin, p.x());
+        ymin = std::min(ymin, p.y());
+        xmax = std::max(xmax, p.x());
+        ymax = std::max(ymax, p.y());
+    }
+    return {{xmin, ymin}, {xmax, ymax}};
+}
+
+std::vector<Query> generate_queries(const std::vector<Point> & points, const QueryOptions & options)
+{
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Rect box = bounds(points);
+    double width = box.xmax() - box.xmin(), height = box.ymax() - box.ymin();
+
+    std::vector<Point> hotspots;
+    std::vector<double> weights;
+    if (!points.empty()) {
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.hotspots, 1); ++i) {
+            hotspots.push_back(points[rng() % points.size()]);
+            weights.push_back(1.0 / std::pow(static_cast<double>(i + 1), options.skew));
+        }
+    }
+    std::discrete_distribution<std::size_t> hotspot(weights.begin(), weights.end());
+    std::normal_distribution<double> jitter(0.0, 0.01);
+    auto center = [&]() -> Point {
+        if (hotspots.empty()) {
+            return {0, 0};
+        }
+        if (options.skew == 0) {
+            return lerp(box, unit(rng), unit(rng));
+        }
+        const Point & h = hotspots[hotspot(rng)];
+        double dx = jitter(rng) * width;
+        return {h.x() + dx, h.y() + jitter(rng) * height};
+    };
+
+    double total = options.contains_share + options.range_share + options.nearest_share;
+    std::vector<Query> queries;
+    queries.reserve(options.count);
+    for (std::size_t i = 0; i < options.count; ++i) {
+        double kind = unit(rng) * total;
+        if (kind < options.contains_share) {
+            Point p = (!points.empty() && unit(rng) < options.hit_rate) ? points[rng() % points.size()] : center();
+            queries.push_back({QueryKind::Contains, p, {}, 0});
+        }
+        else if (kind < options.contains_share + options.range_share) {
+            double side = std::sqrt(log_uniform(rng, options.min_selectivity, options.max_selectivity)) / 2;
+            Point c = center();
+            Rect rect({c.x() - side * width, c.y() - side * height}, {c.x() + side * width, c.y() + side * height});
+            queries.push_back({QueryKind::Range, c, rect, 0});
+        }
+        else {
+            auto k = static_cast<std::size_t>(std::llround(log_uniform(rng, options.min_k, options.max_k + 0.5)));
+            queries.push_back({QueryKind::Nearest, center(), {}, std::clamp(k, options.min_k, options.max_k)});
+        }
+    }
+    return queries;
+}
+
+void write_points(std::ostream & out, const std::vector<Point> & points)
+{
+    out << std::setprecision(17);
+    for (const auto & p : points) {
+        out << p.x() << ' ' << p.y() << '\n';
+    }
+}
+
+std::vector<Point> read_points(std::istream & in)
+{
+    std::vector<Point> points;
+    double x, y;
+    while (in >> x >> y) {
+        points.emplace_back(x, y);
+    }
+    return points;
+}
+
+void write_queries(std::ostream & out, const std::vector<Query> & queries)
+{
+    out << std::setprecision(17);
+    for (const auto & q : queries) {
+        switch (q.kind) {
+        case QueryKind::Contains:
+            out << "contains " << q.point.x() << ' ' << q.point.y() << '\n';
+            break;
+        case QueryKind::Range:
+            out << "range " << q.rect.xmin() << ' ' << q.rect.ymin() << ' ' << q.rect.xmax() << ' ' << q.rect.ymax() << '\n';
+            break;
+        case QueryKind::Nearest:
+            out << "nearest " << q.point.x() << ' ' << q.point.y() << ' ' << q.k << '\n';
+            break;
+        }
+    }
+}
+
+std::vector<Query> read_queries(std::istream & in)
+{
+    std::vector<Query> queries;
+    std::string kind;
+    while (in >> kind) {
+        double a, b;
+        in >> a >> b;
+        if (kind == "contains") {
+            queries.push_back({QueryKind::Contains, {a, b}, {}, 0});
+        }
+        else if (kind == "range") {
+            double c, d;
+            in >> c >> d;
+            queries.push_back({QueryKind::Range, {(a + c) / 2, (b + d) / 2}, Rect({a, b}, {c, d}), 0});
+        }
+        else if (kind == "nearest") {
+            std::size_t k;
+            in >> k;
+            queries.push_back({QueryKind::Nearest, {a, b}, {}, k});
+        }
+    }
+    return queries;
+}
+
+} // namespace workload
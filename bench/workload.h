@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../primitives.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * Synthetic point and query workloads. Generation is deterministic for a
+ * given seed (and standard library), so a workload can be regenerated
+ * instead of checked in.
+ */
+namespace workload {
+
+enum class Distribution
+{
+    Uniform,
+    Clusters,   // Gaussian mixture
+    Roads,      // points sampled along random polylines
+    Duplicates, // a fraction of points repeats earlier ones exactly
+    Collinear,  // every point on one line, in random order
+    Sorted,     // uniform, sorted lexicographically
+};
+
+const char * name(Distribution);
+std::optional<Distribution> parse_distribution(const std::string &);
+
+struct PointOptions
+{
+    Distribution distribution = Distribution::Uniform;
+    std::size_t count = 1000;
+    std::uint64_t seed = 42;
+    Rect bounds = Rect(Point(0, 0), Point(1, 1));
+    std::size_t clusters = 16;
+    double cluster_sigma = 0.01; // relative to the bounds extent
+    std::size_t roads = 64;
+    double road_noise = 0.0005; // relative to the bounds extent
+    double duplicate_fraction = 0.3;
+};
+
+std::vector<Point> generate_points(const PointOptions &);
+
+enum class QueryKind
+{
+    Contains,
+    Range,
+    Nearest,
+};
+
+struct Query
+{
+    QueryKind kind;
+    Point point;
+    Rect rect;
+    std::size_t k;
+};
+
+struct QueryOptions
+{
+    std::size_t count = 10000;
+    std::uint64_t seed = 42;
+    // Relative weights of the query kinds.
+    double contains_share = 1;
+    double range_share = 1;
+    double nearest_share = 1;
+    // Fraction of contains queries that hit an existing point.
+    double hit_rate = 0.5;
+    // Range rectangles cover a log-uniform fraction of the bounds area.
+    double min_selectivity = 1e-5;
+    double max_selectivity = 1e-2;
+    // k is drawn log-uniformly from [min_k, max_k].
+    std::size_t min_k = 1;
+    std::size_t max_k = 100;
+    // Query centers cluster around `hotspots` data points chosen with a
+    // Zipf(skew) law; skew 0 spreads queries over the whole data set.
+    std::size_t hotspots = 32;
+    double skew = 0;
+};
+
+std::vector<Query> generate_queries(const std::vector<Point> & points, const QueryOptions &);
+
+Rect bounds(const std::vector<Point> & points);
+
+// Text formats: points are "x y" lines as read by PointSet(filename), queries
+// are "contains x y", "range xmin ymin xmax ymax" or "nearest x y k" lines.
+void write_points(std::ostream &, const std::vector<Point> &);
+std::vector<Point> read_points(std::istream &);
+void write_queries(std::ostream &, const std::vector<Query> &);
+std::vector<Query> read_queries(std::istream &);
+
+} // namespace workload
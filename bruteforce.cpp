@@ -0,0 +1,136 @@
+#include "bruteforce.h"
+
+#include "ingest.h"
+
+#include <algorithm>
+
+namespace bruteforce {
+using iterator = PointSet::iterator;
+
+PointSet::PointSet(const std::string & filename)
+    : points(std::make_shared<std::vector<Point>>(filename.empty() ? std::vector<Point>() : ingest::read_points(filename)))
+{
+}
+
+bool PointSet::empty() const
+{
+    return points->empty();
+}
+
+std::size_t PointSet::size() const
+{
+    return points->size();
+}
+
+void PointSet::put(const Point & key)
+{
+    if (contains(key)) {
+        return;
+    }
+    if (points.use_count() > 1) {
+        points = std::make_shared<std::vector<Point>>(*points);
+    }
+    points->push_back(key);
+}
+
+bool PointSet::erase(const Point & key)
+{
+    auto it = std::find(points->begin(), points->end(), key);
+    if (it == points->end()) {
+        return false;
+    }
+    if (points.use_count() > 1) {
+        const auto index = it - points->begin();
+        points = std::make_shared<std::vector<Point>>(*points);
+        it = points->begin() + index;
+    }
+    *it = points->back();
+    points->pop_back();
+    return true;
+}
+
+bool PointSet::contains(const Point & key) const
+{
+    // No early exit, so the loop vectorizes.
+    bool found = false;
+    for (const auto & point : *points) {
+        found |= (point == key);
+    }
+    return found;
+}
+
+iterator PointSet::begin() const
+{
+    if (points->empty()) {
+        return {};
+    }
+    return {points, 0};
+}
+
+std::pair<iterator, iterator> PointSet::make_range(std::vector<Point> && result)
+{
+    if (result.empty()) {
+        return {};
+    }
+    std::sort(result.begin(), result.end());
+    return {{std::make_shared<const std::vector<Point>>(std::move(result)), 0}, {}};
+}
+
+std::pair<iterator, iterator> PointSet::range(const Rect & key) const
+{
+    std::vector<Point> result;
+    for (const auto & point : *points) {
+        if (key.contains(point)) {
+            result.push_back(point);
+        }
+    }
+    return make_range(std::move(result));
+}
+
+std::optional<Point> PointSet::nearest(const Point & key) const
+{
+    auto [begin, end] = nearest(key, 1);
+    if (begin == end) {
+        return {};
+    }
+    return *begin;
+}
+
+std::pair<iterator, iterator> PointSet::nearest(const Point & key, std::size_t k) const
+{
+    if (k == 0 || points->empty()) {
+        return {};
+    }
+    std::vector<double> distances(points->size());
+    for (std::size_t i = 0; i < points->size(); ++i) {
+        double dx = (*points)[i].x() - key.x();
+        double dy = (*points)[i].y() - key.y();
+        distances[i] = dx * dx + dy * dy;
+    }
+    std::vector<std::size_t> order(points->size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    k = std::min(k, order.size());
+    auto closer = [&](std::size_t a, std::size_t b) { return distances[a] < distances[b]; };
+    std::nth_element(order.begin(), order.begin() + (k - 1), order.end(), closer);
+    std::vector<Point> result;
+    for (std::size_t i = 0; i < k; ++i) {
+        result.push_back((*points)[order[i]]);
+    }
+    return make_range(std::move(result));
+}
+
+std::ostream & operator<<(std::ostream & out, const PointSet & set)
+{
+    std::vector<Point> sorted = *set.points;
+    std::sort(sorted.begin(), sorted.end());
+    out << "PointSet {\n";
+    for (const auto & point : sorted) {
+        out << '\t' << point << ",\n";
+    }
+    out << "}";
+    return out;
+}
+
+} // namespace bruteforce
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bruteforce {
+
+/*
+ * Linear-scan point set with the same interface as kdtree::PointSet.
+ * It is the reference for differential testing and the baseline for
+ * deciding below which size a tree stops paying for itself.
+ */
+class PointSet
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Point;
+        using pointer = const Point *;
+        using reference = const Point &;
+
+        iterator()
+        {
+        }
+
+        iterator(std::shared_ptr<const std::vector<Point>> points, std::size_t index)
+            : points(std::move(points))
+            , index(index)
+        {
+        }
+
+        reference operator*() const { return (*points)[index]; }
+        pointer operator->() const { return &(*points)[index]; }
+
+        // Prefix increment
+        iterator & operator++()
+        {
+            if (points && ++index == points->size()) {
+                points = nullptr;
+                index = 0;
+            }
+            return *this;
+        }
+
+        // Postfix increment
+        iterator operator++(int)
+        {
+            iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend bool operator==(const iterator & a, const iterator & b)
+        {
+            return a.points == b.points && a.index == b.index;
+        };
+        friend bool operator!=(const iterator & a, const iterator & b)
+        {
+            return !(a == b);
+        };
+
+    private:
+        std::shared_ptr<const std::vector<Point>> points;
+        std::size_t index = 0;
+    };
+
+    PointSet(const std::string & filename = {});
+
+    bool empty() const;
+    std::size_t size() const;
+    void put(const Point &);
+    // Returns false if the point was not in the set.
+    bool erase(const Point &);
+    bool contains(const Point &) const;
+
+    std::pair<iterator, iterator> range(const Rect &) const;
+
+    iterator begin() const;
+    iterator end() const
+    {
+        return {};
+    }
+
+    std::optional<Point> nearest(const Point &) const;
+    std::pair<iterator, iterator> nearest(const Point &, std::size_t) const;
+
+    friend std::ostream & operator<<(std::ostream &, const PointSet &);
+
+private:
+    static std::pair<iterator, iterator> make_range(std::vector<Point> && points);
+
+    // Shared with iterators from begin(); put() copies on write when an
+    // iterator still holds the old vector.
+    std::shared_ptr<std::vector<Point>> points;
+};
+
+} // namespace bruteforce
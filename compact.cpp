@@ -0,0 +1,367 @@
+#include "compact.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+namespace compact {
+
+namespace {
+constexpr char magic[8] = {'C', 'K', 'D', 'T', 'R', 'E', 'E', '1'};
+constexpr double max_quantum = 4294967295.0;
+
+unsigned width(std::uint32_t extent)
+{
+    unsigned result = 0;
+    for (; extent != 0; extent >>= 1) {
+        ++result;
+    }
+    return result;
+}
+
+void write(std::vector<std::uint64_t> & bits, std::uint64_t & position, std::uint64_t value, unsigned width)
+{
+    if (width == 0) {
+        return;
+    }
+    const std::size_t word = position >> 6;
+    const unsigned shift = position & 63;
+    if (word + 1 >= bits.size()) {
+        bits.resize(word + 2);
+    }
+    bits[word] |= value << shift;
+    if (shift + width > 64) {
+        bits[word + 1] |= value >> (64 - shift);
+    }
+    position += width;
+}
+
+// Children of a node with `count` points: the left one gets the lower half.
+std::size_t left_count(std::size_t count)
+{
+    return count / 2;
+}
+} // namespace
+
+Tree::Tree(const std::vector<Point> & points)
+    : size_(points.size())
+{
+    if (points.empty()) {
+        return;
+    }
+    double lo[2] = {INF, INF}, hi[2] = {-INF, -INF};
+    for (const auto & p : points) {
+        lo[0] = std::min(lo[0], p.x());
+        lo[1] = std::min(lo[1], p.y());
+        hi[0] = std::max(hi[0], p.x());
+        hi[1] = std::max(hi[1], p.y());
+    }
+    for (int a = 0; a < 2; ++a) {
+        origin_[a] = lo[a];
+        scale_[a] = hi[a] > lo[a] ? max_quantum / (hi[a] - lo[a]) : 0;
+    }
+    std::vector<std::array<std::uint32_t, 2>> q;
+    q.reserve(points.size());
+    for (const auto & p : points) {
+        q.push_back({quantize(p.x(), origin_[0], scale_[0]), quantize(p.y(), origin_[1], scale_[1])});
+    }
+    while (((size_ - 1) >> depth_) + 1 > bucket_capacity) {
+        ++depth_;
+    }
+    splits_.assign((std::size_t{1} << depth_) - 1, 0);
+    offsets_.reserve((std::size_t{1} << depth_) + 1);
+
+    std::uint64_t position = 0;
+    auto build = [&](auto && self, std::size_t node, unsigned depth, std::size_t begin, std::size_t count, const Cell & cell) -> void {
+        if (depth == depth_) {
+            offsets_.push_back(position);
+            const unsigned wx = width(cell.hi[0] - cell.lo[0]), wy = width(cell.hi[1] - cell.lo[1]);
+            for (std::size_t i = begin; i < begin + count; ++i) {
+                write(bits_, position, q[i][0] - cell.lo[0], wx);
+                write(bits_, position, q[i][1] - cell.lo[1], wy);
+            }
+            return;
+        }
+        const unsigned a = axis(cell);
+        const std::size_t half = left_count(count);
+        std::uint32_t split = cell.lo[a];
+        if (count != 0) {
+            std::nth_element(q.begin() + begin, q.begin() + begin + half, q.begin() + begin + count,
+                    [a](const auto & l, const auto & r) { return l[a] < r[a]; });
+            split = q[begin + half][a];
+        }
+        splits_[node] = split;
+        Cell left = cell, right = cell;
+        left.hi[a] = split;
+        right.lo[a] = split;
+        self(self, 2 * node + 1, depth + 1, begin, half, left);
+        self(self, 2 * node + 2, depth + 1, begin + half, count - half, right);
+    };
+    build(build, 0, 0, 0, size_, {{0, 0}, {0xFFFFFFFFu, 0xFFFFFFFFu}});
+    offsets_.push_back(position);
+    bits_.resize((position >> 6) + 2);
+    bits_.shrink_to_fit();
+}
+
+unsigned Tree::axis(const Cell & cell) const
+{
+    return cell.hi[1] - cell.lo[1] > cell.hi[0] - cell.lo[0] ? 1 : 0;
+}
+
+double Tree::x(std::uint32_t q) const
+{
+    return scale_[0] > 0 ? origin_[0] + q / scale_[0] : origin_[0];
+}
+
+double Tree::y(std::uint32_t q) const
+{
+    return scale_[1] > 0 ? origin_[1] + q / scale_[1] : origin_[1];
+}
+
+Rect Tree::bounds(const Cell & cell) const
+{
+    return {{x(cell.lo[0]), y(cell.lo[1])}, {x(cell.hi[0]), y(cell.hi[1])}};
+}
+
+std::uint32_t Tree::quantize(double value, double origin, double scale) const
+{
+    double q = std::round((value - origin) * scale);
+    return q <= 0 ? 0 : q >= max_quantum ? 0xFFFFFFFFu : static_cast<std::uint32_t>(q);
+}
+
+std::pair<double, double> Tree::resolution() const
+{
+    return {scale_[0] > 0 ? 0.5 / scale_[0] : 0, scale_[1] > 0 ? 0.5 / scale_[1] : 0};
+}
+
+std::uint64_t Tree::read(std::uint64_t position, unsigned width) const
+{
+    if (width == 0) {
+        return 0;
+    }
+    const std::size_t word = position >> 6;
+    const unsigned shift = position & 63;
+    std::uint64_t value = bits_[word] >> shift;
+    if (shift + width > 64) {
+        value |= bits_[word + 1] << (64 - shift);
+    }
+    return value & ((std::uint64_t{1} << width) - 1);
+}
+
+template <class F>
+void Tree::decode(std::size_t node, std::size_t count, const Cell & cell, F && f) const
+{
+    std::uint64_t position = offsets_[node - splits_.size()];
+    const unsigned wx = width(cell.hi[0] - cell.lo[0]), wy = width(cell.hi[1] - cell.lo[1]);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint32_t qx = cell.lo[0] + static_cast<std::uint32_t>(read(position, wx));
+        position += wx;
+        std::uint32_t qy = cell.lo[1] + static_cast<std::uint32_t>(read(position, wy));
+        position += wy;
+        f(qx, qy);
+    }
+}
+
+template <class Covered, class Found>
+void Tree::visit(std::size_t node, unsigned depth, std::size_t count, const Cell & cell, const Rect & rect, Covered & covered, Found & found) const
+{
+    if (count == 0) {
+        return;
+    }
+    const Rect box = bounds(cell);
+    if (!rect.intersects(box)) {
+        return;
+    }
+    const bool inside = rect.contains(box.left_bottom()) && rect.contains(box.right_top());
+    if (inside && covered(count)) {
+        return;
+    }
+    if (depth == depth_) {
+        decode(node, count, cell, [&](std::uint32_t qx, std::uint32_t qy) {
+            Point point(x(qx), y(qy));
+            if (inside || rect.contains(point)) {
+                found(point);
+            }
+        });
+        return;
+    }
+    const unsigned a = axis(cell);
+    const std::size_t half = left_count(count);
+    Cell left = cell, right = cell;
+    left.hi[a] = right.lo[a] = splits_[node];
+    visit(2 * node + 1, depth + 1, half, left, rect, covered, found);
+    visit(2 * node + 2, depth + 1, count - half, right, rect, covered, found);
+}
+
+bool Tree::contains(const Point & key) const
+{
+    if (size_ == 0) {
+        return false;
+    }
+    const double v[2] = {key.x(), key.y()};
+    std::uint32_t k[2];
+    for (int a = 0; a < 2; ++a) {
+        double q = std::round((v[a] - origin_[a]) * scale_[a]);
+        if (q < 0 || q > max_quantum || (scale_[a] == 0 && v[a] != origin_[a])) {
+            return false;
+        }
+        k[a] = static_cast<std::uint32_t>(q);
+    }
+    auto find = [&](auto && self, std::size_t node, unsigned depth, std::size_t count, const Cell & cell) -> bool {
+        if (count == 0) {
+            return false;
+        }
+        if (depth == depth_) {
+            bool result = false;
+            decode(node, count, cell, [&](std::uint32_t qx, std::uint32_t qy) { result |= (qx == k[0]) & (qy == k[1]); });
+            return result;
+        }
+        const unsigned a = axis(cell);
+        const std::uint32_t split = splits_[node];
+        const std::size_t half = left_count(count);
+        Cell left = cell, right = cell;
+        left.hi[a] = right.lo[a] = split;
+        // Points equal to the split value may sit on either side.
+        return (k[a] <= split && self(self, 2 * node + 1, depth + 1, half, left)) ||
+                (k[a] >= split && self(self, 2 * node + 2, depth + 1, count - half, right));
+    };
+    return find(find, 0, 0, size_, {{0, 0}, {0xFFFFFFFFu, 0xFFFFFFFFu}});
+}
+
+std::vector<Point> Tree::range(const Rect & rect) const
+{
+    std::vector<Point> result;
+    auto covered = [](std::size_t) { return false; };
+    auto found = [&](const Point & point) { result.push_back(point); };
+    visit(0, 0, size_, {{0, 0}, {0xFFFFFFFFu, 0xFFFFFFFFu}}, rect, covered, found);
+    return result;
+}
+
+std::size_t Tree::count(const Rect & rect) const
+{
+    std::size_t result = 0;
+    auto covered = [&](std::size_t count) {
+        result += count;
+        return true;
+    };
+    auto found = [&](const Point &) { ++result; };
+    visit(0, 0, size_, {{0, 0}, {0xFFFFFFFFu, 0xFFFFFFFFu}}, rect, covered, found);
+    return result;
+}
+
+std::vector<Point> Tree::points() const
+{
+    return range({{-INF, -INF}, {INF, INF}});
+}
+
+std::vector<Point> Tree::nearest(const Point & key, std::size_t k) const
+{
+    std::vector<Point> result;
+    if (size_ == 0 || k == 0) {
+        return result;
+    }
+    struct Pending
+    {
+        double distance;
+        std::size_t node;
+        unsigned depth;
+        std::size_t count;
+        Cell cell;
+        bool operator<(const Pending & another) const
+        {
+            return distance > another.distance;
+        }
+    };
+    std::priority_queue<Pending> cells;
+    std::priority_queue<std::pair<double, Point>, std::vector<std::pair<double, Point>>, bool (*)(const std::pair<double, Point> &, const std::pair<double, Point> &)> best(
+            [](const std::pair<double, Point> & a, const std::pair<double, Point> & b) { return a.first < b.first; });
+    const Cell root{{0, 0}, {0xFFFFFFFFu, 0xFFFFFFFFu}};
+    cells.push({bounds(root).distance(key), 0, 0, size_, root});
+    while (!cells.empty() && (best.size() < k || cells.top().distance <= best.top().first)) {
+        Pending now = cells.top();
+        cells.pop();
+        if (now.depth == depth_) {
+            decode(now.node, now.count, now.cell, [&](std::uint32_t qx, std::uint32_t qy) {
+                Point point(x(qx), y(qy));
+                double distance = key.distance(point);
+                if (best.size() < k) {
+                    best.emplace(distance, point);
+                }
+                else if (distance < best.top().first) {
+                    best.pop();
+                    best.emplace(distance, point);
+                }
+            });
+            continue;
+        }
+        const unsigned a = axis(now.cell);
+        const std::size_t half = left_count(now.count);
+        Cell left = now.cell, right = now.cell;
+        left.hi[a] = right.lo[a] = splits_[now.node];
+        if (half != 0) {
+            cells.push({bounds(left).distance(key), 2 * now.node + 1, now.depth + 1, half, left});
+        }
+        if (now.count - half != 0) {
+            cells.push({bounds(right).distance(key), 2 * now.node + 2, now.depth + 1, now.count - half, right});
+        }
+    }
+    result.resize(best.size(), Point(0, 0));
+    for (std::size_t i = result.size(); i-- > 0; best.pop()) {
+        result[i] = best.top().second;
+    }
+    return result;
+}
+
+std::size_t Tree::memory_bytes() const
+{
+    return sizeof(*this) + splits_.capacity() * sizeof(std::uint32_t) + (offsets_.capacity() + bits_.capacity()) * sizeof(std::uint64_t);
+}
+
+void Tree::save(const std::string & filename) const
+{
+    std::ofstream out(filename, std::ios::binary);
+    const std::uint64_t header[3] = {size_, depth_, bits_.size()};
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(origin_), sizeof(origin_));
+    out.write(reinterpret_cast<const char *>(scale_), sizeof(scale_));
+    out.write(reinterpret_cast<const char *>(splits_.data()), static_cast<std::streamsize>(splits_.size() * sizeof(std::uint32_t)));
+    out.write(reinterpret_cast<const char *>(offsets_.data()), static_cast<std::streamsize>(offsets_.size() * sizeof(std::uint64_t)));
+    out.write(reinterpret_cast<const char *>(bits_.data()), static_cast<std::streamsize>(bits_.size() * sizeof(std::uint64_t)));
+    if (!out) {
+        throw std::runtime_error("compact::Tree::save: cannot write " + filename);
+    }
+}
+
+Tree Tree::load(const std::string & filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    char file_magic[8];
+    std::uint64_t header[3];
+    Tree tree;
+    in.read(file_magic, sizeof(file_magic));
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!in || std::memcmp(file_magic, magic, sizeof(magic)) != 0 || header[1] >= 64) {
+        throw std::runtime_error("compact::Tree::load: not a compact tree: " + filename);
+    }
+    tree.size_ = header[0];
+    tree.depth_ = static_cast<unsigned>(header[1]);
+    in.read(reinterpret_cast<char *>(tree.origin_), sizeof(tree.origin_));
+    in.read(reinterpret_cast<char *>(tree.scale_), sizeof(tree.scale_));
+    if (tree.size_ != 0) {
+        tree.splits_.resize((std::size_t{1} << tree.depth_) - 1);
+        tree.offsets_.resize((std::size_t{1} << tree.depth_) + 1);
+    }
+    tree.bits_.resize(header[2]);
+    in.read(reinterpret_cast<char *>(tree.splits_.data()), static_cast<std::streamsize>(tree.splits_.size() * sizeof(std::uint32_t)));
+    in.read(reinterpret_cast<char *>(tree.offsets_.data()), static_cast<std::streamsize>(tree.offsets_.size() * sizeof(std::uint64_t)));
+    in.read(reinterpret_cast<char *>(tree.bits_.data()), static_cast<std::streamsize>(tree.bits_.size() * sizeof(std::uint64_t)));
+    if (!in) {
+        throw std::runtime_error("compact::Tree::load: truncated " + filename);
+    }
+    return tree;
+}
+
+} // namespace compact
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace compact {
+
+/*
+ * Read-only compressed kd-tree for cold data.
+ *
+ * Coordinates are quantized to 32 bits per axis over the bounding box.
+ * The tree is implicit: every level halves the point count, so a node's
+ * range of points follows from its position, and all leaves (buckets of up
+ * to bucket_capacity points) sit on the same level. Each cell is split on
+ * its wider side at the median. Internal nodes keep just the split value.
+ * Bucket points are stored as offsets from the cell's low corner with only
+ * as many bits as the cell is wide, and are decoded while a query visits
+ * the bucket. Points come back dequantized, so they are exact only up to
+ * resolution().
+ */
+class Tree
+{
+public:
+    static constexpr std::size_t bucket_capacity = 32;
+
+    Tree() = default;
+    explicit Tree(const std::vector<Point> & points);
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    // Largest distance between a point and its stored position, per axis.
+    std::pair<double, double> resolution() const;
+
+    // True if a stored point quantizes to the same cell as the key.
+    bool contains(const Point &) const;
+    std::vector<Point> range(const Rect &) const;
+    std::size_t count(const Rect &) const;
+    // The k nearest stored points, closest first.
+    std::vector<Point> nearest(const Point &, std::size_t k) const;
+    // Every point, in bucket order.
+    std::vector<Point> points() const;
+
+    std::size_t memory_bytes() const;
+    void save(const std::string & filename) const;
+    static Tree load(const std::string & filename);
+
+private:
+    struct Cell
+    {
+        std::uint32_t lo[2], hi[2];
+    };
+
+    // Calls covered(count) for subtrees inside the rect (true skips them)
+    // and found(point) for the remaining points inside it.
+    template <class Covered, class Found>
+    void visit(std::size_t node, unsigned depth, std::size_t count, const Cell & cell, const Rect & rect, Covered & covered, Found & found) const;
+    template <class F>
+    void decode(std::size_t node, std::size_t count, const Cell & cell, F && f) const;
+
+    unsigned axis(const Cell &) const;
+    Rect bounds(const Cell &) const;
+    double x(std::uint32_t q) const;
+    double y(std::uint32_t q) const;
+    std::uint32_t quantize(double value, double origin, double scale) const;
+    std::uint64_t read(std::uint64_t position, unsigned width) const;
+
+    std::size_t size_ = 0;
+    unsigned depth_ = 0; // leaves are on this level
+    double origin_[2] = {0, 0};
+    double scale_[2] = {0, 0}; // quanta per unit
+    std::vector<std::uint32_t> splits_;  // internal nodes, heap order
+    std::vector<std::uint64_t> offsets_; // first bit of each bucket
+    std::vector<std::uint64_t> bits_;
+};
+
+} // namespace compact
@@ -0,0 +1,502 @@
+#include "flattree.h"
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace flattree {
+
+namespace {
+// The order on y levels; LessXY is the one on x levels.
+struct LessYX
+{
+    bool operator()(const Point & a, const Point & b) const
+    {
+        return (a.y() < b.y()) | ((a.y() == b.y()) & (a.x() < b.x()));
+    }
+};
+
+// Whether the key belongs right of a node on the given level.
+bool goes_right(const Point & node, const Point & key, unsigned depth)
+{
+    return depth % 2 == 0 ? LessXY()(node, key) : LessYX()(node, key);
+}
+
+double square(double value)
+{
+    return value * value;
+}
+
+void prefetch(const double * xy, std::size_t i)
+{
+    __builtin_prefetch(xy + 2 * i);
+}
+
+// Keys of one packet; lanes past the end of the batch repeat the last key.
+struct Packet
+{
+    alignas(32) double x[packet_width];
+    alignas(32) double y[packet_width];
+    alignas(32) double best[packet_width];
+    std::size_t best_node[packet_width];
+};
+static_assert(packet_width == 4, "the kernels hold one coordinate of a packet in an AVX register");
+
+// Lane bits of the keys equal to their node and of those that belong right
+// of it; lane l compares against (nx[l], ny[l]).
+std::pair<unsigned, unsigned> compare(const Packet & packet, const double * nx, const double * ny, unsigned depth)
+{
+    const double * a = depth % 2 == 0 ? packet.x : packet.y;
+    const double * b = depth % 2 == 0 ? packet.y : packet.x;
+    const double * na = depth % 2 == 0 ? nx : ny;
+    const double * nb = depth % 2 == 0 ? ny : nx;
+#ifdef __AVX__
+    __m256d ka = _mm256_load_pd(a), kb = _mm256_load_pd(b);
+    __m256d va = _mm256_load_pd(na), vb = _mm256_load_pd(nb);
+    __m256d equal_a = _mm256_cmp_pd(va, ka, _CMP_EQ_OQ);
+    __m256d equal = _mm256_and_pd(equal_a, _mm256_cmp_pd(vb, kb, _CMP_EQ_OQ));
+    __m256d right = _mm256_or_pd(_mm256_cmp_pd(va, ka, _CMP_LT_OQ), _mm256_and_pd(equal_a, _mm256_cmp_pd(vb, kb, _CMP_LT_OQ)));
+    return {static_cast<unsigned>(_mm256_movemask_pd(equal)), static_cast<unsigned>(_mm256_movemask_pd(right))};
+#else
+    unsigned equal = 0, right = 0;
+    for (std::size_t lane = 0; lane < packet_width; ++lane) {
+        equal |= static_cast<unsigned>((na[lane] == a[lane]) & (nb[lane] == b[lane])) << lane;
+        right |= static_cast<unsigned>((na[lane] < a[lane]) | ((na[lane] == a[lane]) & (nb[lane] < b[lane]))) << lane;
+    }
+    return {equal, right};
+#endif
+}
+
+// Offers node i to every lane as a nearest candidate; returns the lanes
+// whose key belongs right of it.
+unsigned visit(Packet & packet, const Point & node, std::size_t i, unsigned depth)
+{
+    alignas(32) const double nx[packet_width] = {node.x(), node.x(), node.x(), node.x()};
+    alignas(32) const double ny[packet_width] = {node.y(), node.y(), node.y(), node.y()};
+    unsigned closer = 0;
+#ifdef __AVX__
+    __m256d dx = _mm256_sub_pd(_mm256_load_pd(packet.x), _mm256_load_pd(nx));
+    __m256d dy = _mm256_sub_pd(_mm256_load_pd(packet.y), _mm256_load_pd(ny));
+    __m256d distance = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    __m256d best = _mm256_load_pd(packet.best);
+    __m256d mask = _mm256_cmp_pd(distance, best, _CMP_LT_OQ);
+    _mm256_store_pd(packet.best, _mm256_blendv_pd(best, distance, mask));
+    closer = static_cast<unsigned>(_mm256_movemask_pd(mask));
+#else
+    for (std::size_t lane = 0; lane < packet_width; ++lane) {
+        double distance = square(packet.x[lane] - nx[lane]) + square(packet.y[lane] - ny[lane]);
+        bool better = distance < packet.best[lane];
+        packet.best[lane] = better ? distance : packet.best[lane];
+        closer |= static_cast<unsigned>(better) << lane;
+    }
+#endif
+    for (; closer != 0; closer &= closer - 1) {
+        packet.best_node[__builtin_ctz(closer)] = i;
+    }
+    return compare(packet, nx, ny, depth).second;
+}
+
+// Whether any lane could still find something closer in the cell.
+bool any_closer(const Packet & packet, const Rect & cell)
+{
+#ifdef __AVX__
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d kx = _mm256_load_pd(packet.x), ky = _mm256_load_pd(packet.y);
+    __m256d dx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(_mm256_set1_pd(cell.xmin()), kx), _mm256_sub_pd(kx, _mm256_set1_pd(cell.xmax()))), zero);
+    __m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(_mm256_set1_pd(cell.ymin()), ky), _mm256_sub_pd(ky, _mm256_set1_pd(cell.ymax()))), zero);
+    __m256d bound = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    return _mm256_movemask_pd(_mm256_cmp_pd(bound, _mm256_load_pd(packet.best), _CMP_LT_OQ)) != 0;
+#else
+    bool any = false;
+    for (std::size_t lane = 0; lane < packet_width; ++lane) {
+        double dx = std::max({cell.xmin() - packet.x[lane], packet.x[lane] - cell.xmax(), 0.0});
+        double dy = std::max({cell.ymin() - packet.y[lane], packet.y[lane] - cell.ymax(), 0.0});
+        any |= dx * dx + dy * dy < packet.best[lane];
+    }
+    return any;
+#endif
+}
+
+Packet load(const std::vector<Point> & keys, std::size_t first)
+{
+    Packet packet;
+    for (std::size_t lane = 0; lane < packet_width; ++lane) {
+        const Point & key = keys[std::min(first + lane, keys.size() - 1)];
+        packet.x[lane] = key.x();
+        packet.y[lane] = key.y();
+        packet.best[lane] = INF;
+        packet.best_node[lane] = 1;
+    }
+    return packet;
+}
+
+// Keeps up to `group` lookups in flight. start(state, query) sets a lookup
+// up and prefetches its first node; step(state) handles one node, prefetches
+// the next and returns false once the lookup is finished. Going round the
+// group gives each prefetch time to land before its node is read.
+template <class State, class Start, class Step>
+void interleave(std::size_t count, std::size_t group, Start start, Step step)
+{
+    std::vector<State> states(std::min(std::max<std::size_t>(group, 1), count));
+    std::size_t next = 0;
+    for (auto & state : states) {
+        start(state, next++);
+    }
+    std::size_t active = states.size();
+    while (active != 0) {
+        for (std::size_t i = 0; i < active;) {
+            if (step(states[i])) {
+                ++i;
+            }
+            else if (next < count) {
+                start(states[i], next++);
+                ++i;
+            }
+            else {
+                std::swap(states[i], states[--active]);
+            }
+        }
+    }
+}
+} // namespace
+
+Tree::Tree(std::vector<Point> points)
+{
+    std::sort(points.begin(), points.end(), LessXY());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    size_ = points.size();
+    if (size_ == 0) {
+        return;
+    }
+    // Slot 0 is unused, so that the tree starts at index 1.
+    lines_.resize((size_ + 1 + 3) / 4);
+    build(1, 0, points.begin(), points.end());
+}
+
+Tree::Tree(const kdtree::PointSet & set)
+    : Tree(std::vector<Point>(set.begin(), set.end()))
+{
+}
+
+std::size_t Tree::subtree_size(std::size_t i) const
+{
+    std::size_t result = 0;
+    for (std::size_t first = i, last = i; first <= size_; first = 2 * first, last = 2 * last + 1) {
+        result += std::min(last, size_) - first + 1;
+    }
+    return result;
+}
+
+void Tree::build(std::size_t i, unsigned depth, std::vector<Point>::iterator begin, std::vector<Point>::iterator end)
+{
+    if (begin == end) {
+        return;
+    }
+    auto median = begin + subtree_size(2 * i);
+    if (depth % 2 == 0) {
+        std::nth_element(begin, median, end, LessXY());
+    }
+    else {
+        std::nth_element(begin, median, end, LessYX());
+    }
+    double * to = reinterpret_cast<double *>(lines_.data()) + 2 * i;
+    to[0] = median->x();
+    to[1] = median->y();
+    build(2 * i, depth + 1, begin, median);
+    build(2 * i + 1, depth + 1, median + 1, end);
+}
+
+bool Tree::contains(const Point & key) const
+{
+    if (size_ == 0) {
+        return false;
+    }
+    // Every path runs through all full levels, so the loop has no exits
+    // that depend on the data: the child index is computed, equality only
+    // sets a flag, and the line holding the grandchildren (4i to 4i + 3) is
+    // prefetched two levels ahead.
+    const unsigned full_levels = 63 - __builtin_clzll(size_ + 1);
+    const double * nodes = xy();
+    const double kx = key.x(), ky = key.y();
+    std::size_t i = 1;
+    bool found = false;
+    for (unsigned depth = 0; depth < full_levels; ++depth) {
+        prefetch(nodes, std::min(4 * i, size_));
+        const double nx = nodes[2 * i], ny = nodes[2 * i + 1];
+        found |= (nx == kx) & (ny == ky);
+        const bool odd = depth & 1u;
+        const double na = odd ? ny : nx, nb = odd ? nx : ny;
+        const double ka = odd ? ky : kx, kb = odd ? kx : ky;
+        i = 2 * i + ((na < ka) | ((na == ka) & (nb < kb)));
+    }
+    // The bottom level may be partly filled.
+    if (i <= size_) {
+        found |= node(i) == key;
+    }
+    return found;
+}
+
+std::optional<Point> Tree::nearest(const Point & key) const
+{
+    auto result = nearest(std::vector<Point>{key}, BatchOptions{BatchOptions::Mode::Interleaved, 1});
+    return result.front();
+}
+
+std::vector<Point> Tree::range(const Rect & rect) const
+{
+    std::vector<Point> result;
+    range_impl(1, 0, rect, result);
+    return result;
+}
+
+void Tree::range_impl(std::size_t i, unsigned depth, const Rect & rect, std::vector<Point> & result) const
+{
+    if (i > size_) {
+        return;
+    }
+    const Point point = node(i);
+    if (rect.contains(point)) {
+        result.push_back(point);
+    }
+    // Points equal to the node on the axis can be on either side.
+    const double value = depth % 2 == 0 ? point.x() : point.y();
+    const double lo = depth % 2 == 0 ? rect.xmin() : rect.ymin();
+    const double hi = depth % 2 == 0 ? rect.xmax() : rect.ymax();
+    if (lo <= value) {
+        range_impl(2 * i, depth + 1, rect, result);
+    }
+    if (hi >= value) {
+        range_impl(2 * i + 1, depth + 1, rect, result);
+    }
+}
+
+std::vector<bool> Tree::contains(const std::vector<Point> & keys, const BatchOptions & options) const
+{
+    if (options.mode == BatchOptions::Mode::Packet) {
+        return packet_contains(keys);
+    }
+    struct State
+    {
+        std::size_t query;
+        std::size_t i;
+        unsigned depth;
+    };
+    std::vector<bool> result(keys.size());
+    const double * nodes = xy();
+    interleave<State>(
+            keys.size(), options.group,
+            [&](State & state, std::size_t query) {
+                state = {query, 1, 0};
+                if (size_ != 0) {
+                    prefetch(nodes, 1);
+                }
+            },
+            [&](State & state) {
+                if (state.i > size_) {
+                    return false;
+                }
+                const Point & key = keys[state.query];
+                const Point point = node(state.i);
+                if (point == key) {
+                    result[state.query] = true;
+                    return false;
+                }
+                state.i = 2 * state.i + goes_right(point, key, state.depth++);
+                if (state.i > size_) {
+                    return false;
+                }
+                prefetch(nodes, state.i);
+                return true;
+            });
+    return result;
+}
+
+std::vector<std::optional<Point>> Tree::nearest(const std::vector<Point> & keys, const BatchOptions & options) const
+{
+    struct Pending
+    {
+        std::size_t i;
+        unsigned depth;
+        double plane; // squared distance to the splitting line
+    };
+    struct State
+    {
+        std::size_t query;
+        std::size_t i;
+        unsigned depth;
+        std::size_t best;
+        double best_distance;
+        unsigned top;
+        Pending stack[64];
+    };
+    if (options.mode == BatchOptions::Mode::Packet) {
+        return packet_nearest(keys);
+    }
+    std::vector<std::optional<Point>> result(keys.size());
+    if (size_ == 0) {
+        return result;
+    }
+    const double * nodes = xy();
+    interleave<State>(
+            keys.size(), options.group,
+            [&](State & state, std::size_t query) {
+                state.query = query;
+                state.i = 1;
+                state.depth = 0;
+                state.best = 1;
+                state.best_distance = INF;
+                state.top = 0;
+                prefetch(nodes, 1);
+            },
+            [&](State & state) {
+                const Point & key = keys[state.query];
+                const Point point = node(state.i);
+                const double distance = square(point.x() - key.x()) + square(point.y() - key.y());
+                if (distance < state.best_distance) {
+                    state.best_distance = distance;
+                    state.best = state.i;
+                }
+                const bool right = goes_right(point, key, state.depth);
+                const std::size_t near = 2 * state.i + right;
+                const std::size_t far = 2 * state.i + !right;
+                if (far <= size_) {
+                    const double plane = state.depth % 2 == 0 ? key.x() - point.x() : key.y() - point.y();
+                    state.stack[state.top++] = {far, state.depth + 1, square(plane)};
+                }
+                if (near <= size_) {
+                    state.i = near;
+                    ++state.depth;
+                    prefetch(nodes, near);
+                    return true;
+                }
+                while (state.top != 0) {
+                    const Pending pending = state.stack[--state.top];
+                    if (pending.plane < state.best_distance) {
+                        state.i = pending.i;
+                        state.depth = pending.depth;
+                        prefetch(nodes, pending.i);
+                        return true;
+                    }
+                }
+                result[state.query] = node(state.best);
+                return false;
+            });
+    return result;
+}
+
+std::vector<bool> Tree::packet_contains(const std::vector<Point> & keys) const
+{
+    std::vector<bool> result(keys.size());
+    if (size_ == 0) {
+        return result;
+    }
+    for (std::size_t first = 0; first < keys.size(); first += packet_width) {
+        const Packet packet = load(keys, first);
+        const std::size_t lanes = std::min(packet_width, keys.size() - first);
+        std::size_t i[packet_width];
+        std::fill(i, i + packet_width, 1);
+        unsigned active = (1u << lanes) - 1;
+        unsigned found = 0;
+        for (unsigned depth = 0; active != 0; ++depth) {
+            // Lanes that agree so far read the same node.
+            alignas(32) double nx[packet_width], ny[packet_width];
+            for (std::size_t lane = 0; lane < packet_width; ++lane) {
+                const std::size_t at = (active >> lane) & 1u ? i[lane] : 1;
+                nx[lane] = xy()[2 * at];
+                ny[lane] = xy()[2 * at + 1];
+            }
+            auto [equal, right] = compare(packet, nx, ny, depth);
+            found |= equal & active;
+            active &= ~equal;
+            for (std::size_t lane = 0; lane < packet_width; ++lane) {
+                i[lane] = 2 * i[lane] + ((right >> lane) & 1u);
+                if (i[lane] > size_) {
+                    active &= ~(1u << lane);
+                }
+                else {
+                    prefetch(xy(), 2 * i[lane]);
+                }
+            }
+        }
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            result[first + lane] = (found >> lane) & 1u;
+        }
+    }
+    return result;
+}
+
+std::vector<std::optional<Point>> Tree::packet_nearest(const std::vector<Point> & keys) const
+{
+    struct Pending
+    {
+        std::size_t i;
+        unsigned depth;
+        Rect cell;
+    };
+    std::vector<std::optional<Point>> result(keys.size());
+    if (size_ == 0) {
+        return result;
+    }
+    // Walks one lane down its own path from node i.
+    auto seed = [this](Packet & packet, unsigned lane, std::size_t i, unsigned depth) {
+        const Point key(packet.x[lane], packet.y[lane]);
+        for (; i <= size_; i = 2 * i + goes_right(node(i), key, depth++)) {
+            const double distance = square(xy()[2 * i] - key.x()) + square(xy()[2 * i + 1] - key.y());
+            if (distance < packet.best[lane]) {
+                packet.best[lane] = distance;
+                packet.best_node[lane] = i;
+            }
+        }
+    };
+    const unsigned all_lanes = (1u << packet_width) - 1;
+    std::vector<Pending> stack;
+    for (std::size_t first = 0; first < keys.size(); first += packet_width) {
+        Packet packet = load(keys, first);
+        // On the way down to the first leaf, a lane that leaves the packet's
+        // path high up finishes its own path alone, so that every lane has a
+        // bound from its own neighbourhood before the packet backtracks.
+        // Otherwise one stray lane drags the packet through the whole tree.
+        bool first_path = true;
+        unsigned along = all_lanes;
+        stack.push_back({1, 0, Rect(Point(-INF, -INF), Point(INF, INF))});
+        while (!stack.empty()) {
+            const Pending pending = stack.back();
+            stack.pop_back();
+            if (!any_closer(packet, pending.cell)) {
+                continue;
+            }
+            const Point point = node(pending.i);
+            const unsigned right = visit(packet, point, pending.i, pending.depth);
+            // The packet goes first where most of its lanes would.
+            const bool near_right = 2 * __builtin_popcount(right) > static_cast<int>(packet_width);
+            const std::size_t near = 2 * pending.i + near_right;
+            const std::size_t far = 2 * pending.i + !near_right;
+            if (first_path && 8 * far <= size_) {
+                const unsigned leaving = along & (near_right ? ~right : right);
+                for (unsigned rest = leaving; rest != 0; rest &= rest - 1) {
+                    seed(packet, __builtin_ctz(rest), far, pending.depth + 1);
+                }
+                along &= ~leaving;
+            }
+            first_path = first_path && near <= size_;
+            // Points equal to the node on the axis can be on either side, so
+            // both cells keep the line.
+            const Rect & cell = pending.cell;
+            const bool vertical = pending.depth % 2 == 0;
+            const Rect left(cell.left_bottom(), vertical ? Point(point.x(), cell.ymax()) : Point(cell.xmax(), point.y()));
+            const Rect right_side(vertical ? Point(point.x(), cell.ymin()) : Point(cell.xmin(), point.y()), cell.right_top());
+            if (far <= size_) {
+                stack.push_back({far, pending.depth + 1, near_right ? left : right_side});
+            }
+            if (near <= size_) {
+                stack.push_back({near, pending.depth + 1, near_right ? right_side : left});
+            }
+        }
+        for (std::size_t lane = 0; lane < packet_width && first + lane < keys.size(); ++lane) {
+            result[first + lane] = node(packet.best_node[lane]);
+        }
+    }
+    return result;
+}
+
+} // namespace flattree
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <optional>
+#include <vector>
+
+namespace flattree {
+
+// Queries that descend the tree together in packet mode.
+constexpr std::size_t packet_width = 4;
+
+struct BatchOptions
+{
+    enum class Mode
+    {
+        // Independent lookups, interleaved to hide memory latency.
+        Interleaved,
+        // Consecutive keys go in packets of packet_width that walk the tree
+        // in lockstep, testing every lane against a node with one SIMD
+        // compare. Pays off when neighbouring keys are close, e.g. points
+        // along a sorted GPS trace.
+        Packet,
+    };
+    Mode mode = Mode::Interleaved;
+    // Lookups kept in flight at once; enough to cover a miss to memory.
+    std::size_t group = 16;
+};
+
+/*
+ * Read-only kd-tree in one array, without pointers.
+ *
+ * Nodes are laid out in BFS (Eytzinger) order from index 1, so the children
+ * of node i are 2i and 2i + 1 and the tree is complete. Levels alternate
+ * between x and y; a node splits its points by (x, y) order on x levels and
+ * by (y, x) order on y levels, so that every point has exactly one place and
+ * an exact-match descent never has to look at both children.
+ *
+ * The batch queries either keep several lookups in flight, each a small
+ * state machine that prefetches its next node and moves on to another
+ * lookup instead of waiting for the load, or run packets of keys through
+ * the tree together (BatchOptions::Mode).
+ */
+class Tree
+{
+public:
+    Tree() = default;
+    // Duplicates are dropped.
+    explicit Tree(std::vector<Point> points);
+    explicit Tree(const kdtree::PointSet & set);
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    bool contains(const Point &) const;
+    std::optional<Point> nearest(const Point &) const;
+    std::vector<Point> range(const Rect &) const;
+
+    std::vector<bool> contains(const std::vector<Point> & keys, const BatchOptions & options = {}) const;
+    std::vector<std::optional<Point>> nearest(const std::vector<Point> & keys, const BatchOptions & options = {}) const;
+
+    std::size_t memory_bytes() const
+    {
+        return lines_.capacity() * sizeof(Line);
+    }
+
+private:
+    // Four nodes to a cache line: the grandchildren of node i, 4i to 4i + 3,
+    // share one line.
+    struct alignas(64) Line
+    {
+        double xy[8];
+    };
+
+    const double * xy() const
+    {
+        return reinterpret_cast<const double *>(lines_.data());
+    }
+    Point node(std::size_t i) const
+    {
+        return {xy()[2 * i], xy()[2 * i + 1]};
+    }
+
+    void build(std::size_t i, unsigned depth, std::vector<Point>::iterator begin, std::vector<Point>::iterator end);
+    std::size_t subtree_size(std::size_t i) const;
+    void range_impl(std::size_t i, unsigned depth, const Rect & rect, std::vector<Point> & result) const;
+    std::vector<bool> packet_contains(const std::vector<Point> & keys) const;
+    std::vector<std::optional<Point>> packet_nearest(const std::vector<Point> & keys) const;
+
+    std::size_t size_ = 0;
+    std::vector<Line> lines_;
+};
+
+} // namespace flattree
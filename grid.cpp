@@ -0,0 +1,237 @@
+#include "grid.h"
+
+#include <stdexcept>
+
+namespace grid {
+
+PointSet::PointSet(double cell_size, std::size_t bucket_count)
+    : cell_size_(cell_size)
+    , inverse_cell_(1.0 / cell_size)
+{
+    if (!(cell_size > 0)) {
+        throw std::invalid_argument("grid::PointSet: cell size must be positive");
+    }
+    buckets_.resize(1);
+    mask_ = 0;
+    grow(bucket_count);
+}
+
+void PointSet::grow(std::size_t count)
+{
+    std::size_t size = buckets_.size();
+    while (size < count && size < (std::size_t{1} << 31)) {
+        size <<= 1;
+    }
+    if (size == buckets_.size()) {
+        return;
+    }
+    std::vector<Bucket> old(size);
+    old.swap(buckets_);
+    mask_ = static_cast<std::uint32_t>(size - 1);
+    for (const Bucket & bucket : old) {
+        for (std::size_t i = 0; i < bucket.ids.size(); ++i) {
+            const Point point(bucket.xs[i], bucket.ys[i]);
+            push(bucket_of(point), bucket.ids[i], point);
+        }
+    }
+}
+
+void PointSet::push(std::uint32_t bucket, Id id, const Point & point)
+{
+    Bucket & target = buckets_[bucket];
+    locations_[id] = {bucket, static_cast<std::uint32_t>(target.ids.size())};
+    target.xs.push_back(point.x());
+    target.ys.push_back(point.y());
+    target.ids.push_back(id);
+}
+
+// Swap-with-last removal; the point moved into the hole gets its slot updated.
+void PointSet::remove(const Location & location)
+{
+    Bucket & bucket = buckets_[location.bucket];
+    std::uint32_t last = static_cast<std::uint32_t>(bucket.ids.size() - 1);
+    if (location.slot != last) {
+        bucket.xs[location.slot] = bucket.xs[last];
+        bucket.ys[location.slot] = bucket.ys[last];
+        bucket.ids[location.slot] = bucket.ids[last];
+        locations_[bucket.ids[location.slot]].slot = location.slot;
+    }
+    bucket.xs.pop_back();
+    bucket.ys.pop_back();
+    bucket.ids.pop_back();
+}
+
+PointSet::Id PointSet::insert(const Point & point)
+{
+    Id id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    }
+    else {
+        id = static_cast<Id>(locations_.size());
+        locations_.push_back({dead, 0});
+    }
+    push(bucket_of(point), id, point);
+    ++size_;
+    if (size_ > max_load * buckets_.size()) {
+        grow(size_);
+    }
+    return id;
+}
+
+void PointSet::move(Id id, const Point & point)
+{
+    Location location = locations_.at(id);
+    if (location.bucket == dead) {
+        throw std::out_of_range("grid::PointSet::move: erased id");
+    }
+    std::uint32_t bucket = bucket_of(point);
+    if (bucket == location.bucket) {
+        buckets_[bucket].xs[location.slot] = point.x();
+        buckets_[bucket].ys[location.slot] = point.y();
+        return;
+    }
+    remove(location);
+    push(bucket, id, point);
+}
+
+void PointSet::erase(Id id)
+{
+    Location location = locations_.at(id);
+    if (location.bucket == dead) {
+        return;
+    }
+    remove(location);
+    locations_[id].bucket = dead;
+    free_ids_.push_back(id);
+    --size_;
+}
+
+bool PointSet::alive(Id id) const
+{
+    return id < locations_.size() && locations_[id].bucket != dead;
+}
+
+Point PointSet::position(Id id) const
+{
+    Location location = locations_.at(id);
+    if (location.bucket == dead) {
+        throw std::out_of_range("grid::PointSet::position: erased id");
+    }
+    return {buckets_[location.bucket].xs[location.slot], buckets_[location.bucket].ys[location.slot]};
+}
+
+void PointSet::buckets_for(const Rect & rect, std::vector<std::uint32_t> & result) const
+{
+    result.clear();
+    std::int64_t x0 = cell(rect.xmin()), x1 = cell(rect.xmax());
+    std::int64_t y0 = cell(rect.ymin()), y1 = cell(rect.ymax());
+    double cells = (static_cast<double>(x1 - x0) + 1) * (static_cast<double>(y1 - y0) + 1);
+    if (!(cells <= buckets_.size())) {
+        // The window covers more cells than there are buckets: scan everything.
+        for (std::uint32_t b = 0; b <= mask_; ++b) {
+            if (!buckets_[b].ids.empty()) {
+                result.push_back(b);
+            }
+        }
+        return;
+    }
+    for (std::int64_t cx = x0; cx <= x1; ++cx) {
+        for (std::int64_t cy = y0; cy <= y1; ++cy) {
+            result.push_back(bucket_of(cx, cy));
+        }
+    }
+    // Distinct cells may share a bucket; each bucket must be scanned once.
+    if (result.size() <= 16) {
+        std::size_t unique = 0;
+        for (std::uint32_t b : result) {
+            if (std::find(result.begin(), result.begin() + unique, b) == result.begin() + unique) {
+                result[unique++] = b;
+            }
+        }
+        result.resize(unique);
+    }
+    else {
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+}
+
+std::vector<PointSet::Id> PointSet::radius(const Point & center, double radius) const
+{
+    std::vector<Id> result;
+    for_each_in_radius(center, radius, [&](Id id, const Point &) { result.push_back(id); });
+    return result;
+}
+
+std::vector<PointSet::Id> PointSet::range(const Rect & rect) const
+{
+    std::vector<Id> result;
+    for_each_in_range(rect, [&](Id id, const Point &) { result.push_back(id); });
+    return result;
+}
+
+void PointSet::rebuild(const std::vector<Point> & points, unsigned threads)
+{
+    const std::size_t n = points.size();
+    if (n > max_load * buckets_.size()) {
+        // Nothing worth moving: the old contents are replaced anyway.
+        buckets_.clear();
+        buckets_.resize(1);
+        mask_ = 0;
+        grow(n);
+    }
+    const std::size_t bucket_count = buckets_.size();
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(n / 4096 + 1)));
+
+    auto parallel = [threads](std::size_t total, auto && body) {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            std::size_t begin = total * t / threads, end = total * (t + 1) / threads;
+            workers.emplace_back([&body, t, begin, end] { body(t, begin, end); });
+        }
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    };
+
+    // Counting sort: bucket of every point, per-thread histograms, then
+    // per-thread write offsets inside every bucket.
+    std::vector<std::uint32_t> bucket_of_point(n);
+    std::vector<std::vector<std::uint32_t>> counts(threads, std::vector<std::uint32_t>(bucket_count));
+    parallel(n, [&](unsigned t, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            bucket_of_point[i] = bucket_of(points[i]);
+            ++counts[t][bucket_of_point[i]];
+        }
+    });
+    parallel(bucket_count, [&](unsigned, std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin; b < end; ++b) {
+            std::uint32_t offset = 0;
+            for (unsigned t = 0; t < threads; ++t) {
+                std::uint32_t count = counts[t][b];
+                counts[t][b] = offset;
+                offset += count;
+            }
+            buckets_[b].xs.resize(offset);
+            buckets_[b].ys.resize(offset);
+            buckets_[b].ids.resize(offset);
+        }
+    });
+    locations_.resize(n);
+    parallel(n, [&](unsigned t, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::uint32_t b = bucket_of_point[i];
+            std::uint32_t slot = counts[t][b]++;
+            buckets_[b].xs[slot] = points[i].x();
+            buckets_[b].ys[slot] = points[i].y();
+            buckets_[b].ids[slot] = static_cast<Id>(i);
+            locations_[i] = {b, slot};
+        }
+    });
+    free_ids_.clear();
+    size_ = n;
+}
+
+} // namespace grid
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace grid {
+
+/*
+ * Hashed uniform grid for moving points and fixed-radius queries.
+ *
+ * The plane is cut into square cells of side `cell_size` (pick roughly the
+ * query radius); cells are hashed into buckets, so memory depends on the
+ * number of points, not on the extent of the data. The bucket count is a
+ * power of two that starts at `bucket_count` and grows with the number of
+ * points (insert() and rebuild() rehash once the average bucket holds more
+ * than max_load points); it never shrinks.
+ * Each bucket keeps its points as separate x, y and id arrays. Points are
+ * addressed by the Id returned from insert(), which stays valid across
+ * move() until erase().
+ */
+class PointSet
+{
+public:
+    using Id = std::uint32_t;
+
+    static constexpr std::size_t max_load = 4;
+
+    explicit PointSet(double cell_size, std::size_t bucket_count = std::size_t{1} << 12);
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    double cell_size() const
+    {
+        return cell_size_;
+    }
+    std::size_t bucket_count() const
+    {
+        return buckets_.size();
+    }
+
+    Id insert(const Point &);
+    void move(Id, const Point &);
+    void erase(Id);
+    bool alive(Id) const;
+    Point position(Id) const;
+
+    // Calls f(id, point) for every point within `radius` of `center`
+    // (boundary included).
+    template <class F>
+    void for_each_in_radius(const Point & center, double radius, F && f) const;
+    std::vector<Id> radius(const Point & center, double radius) const;
+
+    template <class F>
+    void for_each_in_range(const Rect & rect, F && f) const;
+    std::vector<Id> range(const Rect & rect) const;
+
+    // Replaces the contents with `points`, which get ids 0..n-1. Points
+    // are distributed to buckets by a parallel counting sort.
+    void rebuild(const std::vector<Point> & points, unsigned threads = std::thread::hardware_concurrency());
+
+private:
+    struct Bucket
+    {
+        std::vector<double> xs, ys;
+        std::vector<Id> ids;
+    };
+
+    struct Location
+    {
+        std::uint32_t bucket;
+        std::uint32_t slot;
+    };
+
+    static constexpr std::uint32_t dead = std::numeric_limits<std::uint32_t>::max();
+
+    std::int64_t cell(double coordinate) const
+    {
+        return static_cast<std::int64_t>(std::floor(coordinate * inverse_cell_));
+    }
+
+    std::uint32_t bucket_of(std::int64_t cx, std::int64_t cy) const
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(cx) * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint64_t>(cy) * 0xC2B2AE3D27D4EB4Full;
+        return static_cast<std::uint32_t>((h ^ (h >> 29)) & mask_);
+    }
+
+    std::uint32_t bucket_of(const Point & point) const
+    {
+        return bucket_of(cell(point.x()), cell(point.y()));
+    }
+
+    void push(std::uint32_t bucket, Id id, const Point & point);
+    // Rehashes into the smallest power of two of buckets not below `count`.
+    void grow(std::size_t count);
+    void remove(const Location & location);
+
+    // Distinct buckets covering the cells that overlap `rect`.
+    void buckets_for(const Rect & rect, std::vector<std::uint32_t> & result) const;
+
+    double cell_size_;
+    double inverse_cell_;
+    std::uint32_t mask_;
+    std::vector<Bucket> buckets_;
+    std::vector<Location> locations_; // indexed by Id
+    std::vector<Id> free_ids_;
+    std::size_t size_ = 0;
+};
+
+template <class F>
+void PointSet::for_each_in_radius(const Point & center, double radius, F && f) const
+{
+    // Local to the call: `f` may itself query the grid.
+    std::vector<std::uint32_t> buckets;
+    buckets_for(Rect({center.x() - radius, center.y() - radius}, {center.x() + radius, center.y() + radius}), buckets);
+    const double r2 = radius * radius;
+    for (std::uint32_t b : buckets) {
+        const Bucket & bucket = buckets_[b];
+        const std::size_t n = bucket.ids.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            double dx = bucket.xs[i] - center.x();
+            double dy = bucket.ys[i] - center.y();
+            if (dx * dx + dy * dy <= r2) {
+                f(bucket.ids[i], Point(bucket.xs[i], bucket.ys[i]));
+            }
+        }
+    }
+}
+
+template <class F>
+void PointSet::for_each_in_range(const Rect & rect, F && f) const
+{
+    std::vector<std::uint32_t> buckets;
+    buckets_for(rect, buckets);
+    for (std::uint32_t b : buckets) {
+        const Bucket & bucket = buckets_[b];
+        const std::size_t n = bucket.ids.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            double x = bucket.xs[i], y = bucket.ys[i];
+            if (x >= rect.xmin() && x <= rect.xmax() && y >= rect.ymin() && y <= rect.ymax()) {
+                f(bucket.ids[i], Point(x, y));
+            }
+        }
+    }
+}
+
+} // namespace grid
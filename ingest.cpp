@@ -0,0 +1,188 @@
+#include "ingest.h"
+
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+
+namespace ingest {
+
+namespace {
+template <class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t capacity)
+        : capacity_(std::max<std::size_t>(capacity, 1))
+    {
+    }
+
+    void push(T && value)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+        items_.push_back(std::move(value));
+        not_empty_.notify_one();
+    }
+
+    // Empty once the queue is closed and drained.
+    std::optional<T> pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return {};
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return value;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    std::size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_, not_full_;
+};
+
+bool space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+std::vector<Point> merge(const std::vector<Point> & a, const std::vector<Point> & b)
+{
+    std::vector<Point> result;
+    result.reserve(a.size() + b.size());
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result), LessXY());
+    return result;
+}
+} // namespace
+
+std::vector<Point> read_points(const std::string & filename, const Options & options)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return {};
+    }
+    BoundedQueue<std::vector<char>> blocks(options.queue_depth);
+    BoundedQueue<std::vector<Point>> runs(options.queue_depth);
+
+    std::thread reader([&] {
+        std::vector<char> carry;
+        while (in) {
+            std::vector<char> block(std::move(carry));
+            std::size_t old = block.size();
+            block.resize(old + options.block_size);
+            in.read(block.data() + old, static_cast<std::streamsize>(options.block_size));
+            block.resize(old + static_cast<std::size_t>(in.gcount()));
+            carry.clear();
+            if (in) {
+                // Keep the unfinished last line for the next block.
+                auto cut = std::find(block.rbegin(), block.rend(), '\n').base();
+                carry.assign(cut, block.end());
+                block.erase(cut, block.end());
+            }
+            if (!block.empty()) {
+                blocks.push(std::move(block));
+            }
+        }
+        blocks.close();
+    });
+    std::vector<std::thread> parsers;
+    for (unsigned i = 0; i < std::max(1u, options.parsers); ++i) {
+        parsers.emplace_back([&] {
+            while (auto block = blocks.pop()) {
+                runs.push(parse_points(block->data(), block->data() + block->size()));
+            }
+        });
+    }
+    std::thread closer([&] {
+        for (auto & parser : parsers) {
+            parser.join();
+        }
+        runs.close();
+    });
+
+    // levels[i] holds a run built from about 2^i blocks, or nothing.
+    std::vector<std::vector<Point>> levels;
+    while (auto run = runs.pop()) {
+        std::vector<Point> carry = std::move(*run);
+        std::size_t level = 0;
+        for (; level < levels.size() && !levels[level].empty(); ++level) {
+            carry = merge(levels[level], carry);
+            levels[level].clear();
+            levels[level].shrink_to_fit();
+        }
+        if (level == levels.size()) {
+            levels.emplace_back();
+        }
+        levels[level] = std::move(carry);
+    }
+    reader.join();
+    closer.join();
+
+    std::vector<Point> result;
+    for (auto & level : levels) {
+        if (!level.empty()) {
+            result = result.empty() ? std::move(level) : merge(level, result);
+        }
+    }
+    return result;
+}
+
+std::vector<Point> parse_points(const char * begin, const char * end)
+{
+    std::vector<Point> result;
+    const char * now = begin;
+    while (now != end) {
+        // Every line stands alone, so blocks cut at newlines parse the same
+        // as the whole text.
+        const char * eol = std::find(now, end, '\n');
+        const std::size_t line_start = result.size();
+        double value[2];
+        int have = 0;
+        while (true) {
+            while (now != eol && space(*now)) {
+                ++now;
+            }
+            if (now == eol) {
+                break;
+            }
+            // from_chars takes no sign but '-'.
+            if (*now == '+' && now + 1 != eol && now[1] != '-' && now[1] != '+') {
+                ++now;
+            }
+            auto [next, error] = std::from_chars(now, eol, value[have]);
+            if (error != std::errc() || (next != eol && !space(*next)) || !std::isfinite(value[have])) {
+                // Not a finite number: drop the whole line.
+                result.erase(result.begin() + line_start, result.end());
+                break;
+            }
+            now = next;
+            if (++have == 2) {
+                result.emplace_back(value[0], value[1]);
+                have = 0;
+            }
+        }
+        // An unpaired last number on a line is dropped too.
+        now = eol == end ? end : eol + 1;
+    }
+    std::sort(result.begin(), result.end(), LessXY());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+} // namespace ingest
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ingest {
+
+struct Options
+{
+    std::size_t block_size = std::size_t{4} << 20; // bytes per read
+    unsigned parsers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    std::size_t queue_depth = 8; // blocks or parsed runs in flight per stage
+};
+
+/*
+ * Pipelined reader for text files of "x y" lines. A reader thread pulls
+ * large blocks and cuts them at the last newline; parser threads turn
+ * blocks into sorted, duplicate-free runs; the calling thread merges runs
+ * of equal rank as they arrive (a binary counter), so that by the end of the
+ * file only a few merges remain. The queues between stages are bounded, so
+ * at most queue_depth blocks are in flight. Returns the points sorted by
+ * LessXY, without duplicates; a file that cannot be opened reads as empty.
+ */
+std::vector<Point> read_points(const std::string & filename, const Options & options = {});
+
+// Parses "x y" text; the result is sorted by LessXY and free of duplicates.
+// Each line is parsed on its own: a line holding anything that is not a
+// finite number (nan and inf included) is skipped, and so is an odd number
+// left at the end of a line.
+std::vector<Point> parse_points(const char * begin, const char * end);
+
+} // namespace ingest
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Per-operation latency histograms.
+ *
+ * Each thread records into its own histograms (single writer, relaxed
+ * atomics, no locks on the hot path); merge() folds all threads together
+ * on demand. Samples are taken in TSC ticks where available and converted
+ * to nanoseconds only when merging.
+ *
+ * Recording is compiled in only with KDTREE_LATENCY; otherwise
+ * KDTREE_LATENCY_SCOPE(...) expands to nothing and merge() reports zeros.
+ */
+#ifdef KDTREE_LATENCY
+#define KDTREE_LATENCY_SCOPE(op) ::latency::Timer kdtree_latency_timer_(op)
+#else
+#define KDTREE_LATENCY_SCOPE(op)
+#endif
+
+namespace latency {
+
+enum class Op
+{
+    Put,
+    Contains,
+    Range,
+    Nearest,
+    Build,
+    Erase,
+    Count,
+};
+
+inline const char * name(Op op)
+{
+    static const char * const names[] = {"put", "contains", "range", "nearest", "build", "erase"};
+    return names[static_cast<int>(op)];
+}
+
+inline std::uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Log-linear buckets: exact below 16, then 16 sub-buckets per power of
+// two, i.e. about 6% relative precision over the whole 64-bit range.
+class Histogram
+{
+public:
+    static constexpr unsigned sub_bits = 4;
+    static constexpr std::size_t sub_count = std::size_t{1} << sub_bits;
+    static constexpr std::size_t buckets = (64 - sub_bits + 1) * sub_count;
+
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < sub_count) {
+            return value;
+        }
+        unsigned exponent = 63 - __builtin_clzll(value);
+        std::size_t sub = (value >> (exponent - sub_bits)) & (sub_count - 1);
+        return (exponent - sub_bits + 1) * sub_count + sub;
+    }
+
+    // Smallest value that maps to bucket i.
+    static std::uint64_t lower_bound(std::size_t i)
+    {
+        if (i < sub_count) {
+            return i;
+        }
+        unsigned exponent = static_cast<unsigned>(i / sub_count) + sub_bits - 1;
+        return (std::uint64_t{1} << exponent) | (static_cast<std::uint64_t>(i % sub_count) << (exponent - sub_bits));
+    }
+
+    // Only the owning thread calls record(), so a relaxed load/store pair
+    // is enough and compiles to a plain increment.
+    void record(std::uint64_t value)
+    {
+        auto & bucket = counts_[index(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t bucket(std::size_t i) const
+    {
+        return counts_[i].load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto & count : counts_) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, buckets> counts_{};
+};
+
+struct Summary
+{
+    std::uint64_t count = 0;
+    double mean_ns = 0;
+    double p50_ns = 0;
+    double p90_ns = 0;
+    double p99_ns = 0;
+    double p999_ns = 0;
+    double max_ns = 0;
+};
+
+class Registry
+{
+public:
+    using ThreadHistograms = std::array<Histogram, static_cast<std::size_t>(Op::Count)>;
+
+    static Registry & instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    // Histograms of the calling thread. When the thread exits its samples
+    // are folded into a retired total, so that merge() still counts them
+    // and threads that come and go do not pile up histograms.
+    static ThreadHistograms & local()
+    {
+        thread_local Local local;
+        return *local.histograms;
+    }
+
+    std::array<Summary, static_cast<std::size_t>(Op::Count)> merge() const
+    {
+        std::vector<std::uint64_t> counts(Histogram::buckets);
+        std::array<Summary, static_cast<std::size_t>(Op::Count)> result;
+        double ns_per_tick = calibrate();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t op = 0; op < result.size(); ++op) {
+            std::copy_n(retired_.begin() + op * Histogram::buckets, Histogram::buckets, counts.begin());
+            for (const auto & thread : threads_) {
+                for (std::size_t i = 0; i < Histogram::buckets; ++i) {
+                    counts[i] += (*thread)[op].bucket(i);
+                }
+            }
+            result[op] = summarize(counts, ns_per_tick);
+        }
+        return result;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto & thread : threads_) {
+            for (auto & histogram : *thread) {
+                histogram.reset();
+            }
+        }
+        std::fill(retired_.begin(), retired_.end(), 0);
+    }
+
+private:
+    struct Local
+    {
+        std::shared_ptr<ThreadHistograms> histograms = instance().add();
+
+        ~Local()
+        {
+            instance().retire(histograms);
+        }
+    };
+
+    Registry()
+        : start_ticks_(ticks())
+        , start_time_(std::chrono::steady_clock::now())
+        , retired_(static_cast<std::size_t>(Op::Count) * Histogram::buckets)
+    {
+    }
+
+    std::shared_ptr<ThreadHistograms> add()
+    {
+        auto histograms = std::make_shared<ThreadHistograms>();
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.push_back(histograms);
+        return histograms;
+    }
+
+    void retire(const std::shared_ptr<ThreadHistograms> & histograms)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t op = 0; op < histograms->size(); ++op) {
+            for (std::size_t i = 0; i < Histogram::buckets; ++i) {
+                retired_[op * Histogram::buckets + i] += (*histograms)[op].bucket(i);
+            }
+        }
+        threads_.erase(std::find(threads_.begin(), threads_.end(), histograms));
+    }
+
+    double calibrate() const
+    {
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time_).count();
+        auto elapsed_ticks = static_cast<double>(ticks() - start_ticks_);
+        return elapsed_ticks > 0 ? elapsed / elapsed_ticks : 1.0;
+    }
+
+    static Summary summarize(const std::vector<std::uint64_t> & counts, double ns_per_tick)
+    {
+        Summary summary;
+        double sum = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            summary.count += counts[i];
+            sum += static_cast<double>(counts[i]) * Histogram::lower_bound(i);
+        }
+        if (summary.count == 0) {
+            return summary;
+        }
+        summary.mean_ns = sum / summary.count * ns_per_tick;
+        auto quantile = [&](double q) {
+            auto rank = static_cast<std::uint64_t>(q * (summary.count - 1));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                seen += counts[i];
+                if (seen > rank) {
+                    return Histogram::lower_bound(i) * ns_per_tick;
+                }
+            }
+            return 0.0;
+        };
+        summary.p50_ns = quantile(0.5);
+        summary.p90_ns = quantile(0.9);
+        summary.p99_ns = quantile(0.99);
+        summary.p999_ns = quantile(0.999);
+        summary.max_ns = quantile(1.0);
+        return summary;
+    }
+
+    const std::uint64_t start_ticks_;
+    const std::chrono::steady_clock::time_point start_time_;
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadHistograms>> threads_;
+    // Bucket counts of exited threads, Histogram::buckets per op.
+    std::vector<std::uint64_t> retired_;
+};
+
+class Timer
+{
+public:
+    explicit Timer(Op op)
+        : histogram_(Registry::local()[static_cast<std::size_t>(op)])
+        , start_(ticks())
+    {
+    }
+
+    ~Timer()
+    {
+        histogram_.record(ticks() - start_);
+    }
+
+    Timer(const Timer &) = delete;
+    Timer & operator=(const Timer &) = delete;
+
+private:
+    Histogram & histogram_;
+    const std::uint64_t start_;
+};
+
+inline std::array<Summary, static_cast<std::size_t>(Op::Count)> merge()
+{
+    return Registry::instance().merge();
+}
+
+inline void reset()
+{
+    Registry::instance().reset();
+}
+
+inline void dump_text(std::ostream & out)
+{
+    auto summaries = merge();
+    for (std::size_t op = 0; op < summaries.size(); ++op) {
+        const Summary & s = summaries[op];
+        out << name(static_cast<Op>(op)) << ": count=" << s.count << " mean=" << s.mean_ns << "ns p50=" << s.p50_ns
+            << "ns p90=" << s.p90_ns << "ns p99=" << s.p99_ns << "ns p99.9=" << s.p999_ns << "ns max=" << s.max_ns << "ns\n";
+    }
+}
+
+inline void dump_json(std::ostream & out)
+{
+    auto summaries = merge();
+    out << '{';
+    for (std::size_t op = 0; op < summaries.size(); ++op) {
+        const Summary & s = summaries[op];
+        out << (op ? ", " : "") << '"' << name(static_cast<Op>(op)) << "\": {\"count\": " << s.count << ", \"mean_ns\": " << s.mean_ns
+            << ", \"p50_ns\": " << s.p50_ns << ", \"p90_ns\": " << s.p90_ns << ", \"p99_ns\": " << s.p99_ns
+            << ", \"p999_ns\": " << s.p999_ns << ", \"max_ns\": " << s.max_ns << '}';
+    }
+    out << "}\n";
+}
+
+} // namespace latency
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <new>
 #include <type_traits>
+#include <vector>
 
 namespace pool {
 
@@ -108,6 +111,69 @@ inline void deallocate(Pool & pool, void * ptr, const size_t n)
     pool.deallocate(ptr, n);
 }
 
+// Growable pool of fixed-size objects: memory comes in chunks of
+// `chunk_count` objects and freed objects go onto an intrusive free list,
+// so allocate and deallocate are O(1) and objects of one pool sit close
+// together in memory.
+class FreeListPool
+{
+public:
+    FreeListPool(const size_t obj_size, const size_t chunk_count = 256)
+        : m_obj_size((std::max(obj_size, sizeof(void *)) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t))
+        , m_chunk_count(chunk_count)
+    {
+    }
+
+    FreeListPool(const FreeListPool &) = delete;
+    FreeListPool & operator=(const FreeListPool &) = delete;
+
+    void * allocate()
+    {
+        if (m_free == nullptr) {
+            grow();
+        }
+        void * result = m_free;
+        m_free = *static_cast<void **>(m_free);
+        ++m_used;
+        return result;
+    }
+
+    void deallocate(void * ptr)
+    {
+        *static_cast<void **>(ptr) = m_free;
+        m_free = ptr;
+        --m_used;
+    }
+
+    size_t used() const
+    {
+        return m_used;
+    }
+
+    size_t capacity_bytes() const
+    {
+        return m_chunks.size() * m_chunk_count * m_obj_size;
+    }
+
+private:
+    void grow()
+    {
+        m_chunks.emplace_back(new std::max_align_t[(m_chunk_count * m_obj_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)]);
+        auto * chunk = reinterpret_cast<std::byte *>(m_chunks.back().get());
+        for (size_t i = m_chunk_count; i-- > 0;) {
+            void * obj = chunk + i * m_obj_size;
+            *static_cast<void **>(obj) = m_free;
+            m_free = obj;
+        }
+    }
+
+    const size_t m_obj_size;
+    const size_t m_chunk_count;
+    std::vector<std::unique_ptr<std::max_align_t[]>> m_chunks;
+    void * m_free = nullptr;
+    size_t m_used = 0;
+};
+
 } // namespace pool
 
 template <class T>
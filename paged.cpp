@@ -0,0 +1,562 @@
+#include "paged.h"
+
+#include "ingest.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+namespace paged {
+
+namespace {
+constexpr char magic[8] = {'P', 'K', 'D', 'T', 'R', 'E', 'E', '2'};
+
+struct Header
+{
+    char magic[8];
+    std::uint64_t size;
+    std::uint64_t depth;
+    std::uint64_t page_size;
+    std::uint64_t directory;
+};
+
+void read_exact(int fd, void * data, std::size_t bytes, std::uint64_t offset)
+{
+    char * to = static_cast<char *>(data);
+    while (bytes != 0) {
+        ssize_t done = ::pread(fd, to, bytes, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            throw std::runtime_error("paged: read failed");
+        }
+        to += done;
+        bytes -= static_cast<std::size_t>(done);
+        offset += static_cast<std::uint64_t>(done);
+    }
+}
+
+void write_exact(int fd, const void * data, std::size_t bytes, std::uint64_t offset)
+{
+    const char * from = static_cast<const char *>(data);
+    while (bytes != 0) {
+        ssize_t done = ::pwrite(fd, from, bytes, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            throw std::runtime_error("paged: write failed");
+        }
+        from += done;
+        bytes -= static_cast<std::size_t>(done);
+        offset += static_cast<std::uint64_t>(done);
+    }
+}
+
+void read_points(int fd, std::uint64_t index, std::size_t count, Point * to)
+{
+    read_exact(fd, to, count * sizeof(Point), index * sizeof(Point));
+}
+
+void write_points(int fd, std::uint64_t index, std::size_t count, const Point * from)
+{
+    write_exact(fd, from, count * sizeof(Point), index * sizeof(Point));
+}
+
+double coordinate(const Point & point, unsigned axis)
+{
+    return axis == 0 ? point.x() : point.y();
+}
+
+// Points that go to the left child of a node with `count` points and
+// `levels` levels of nodes below it. Leaves are filled from the left, so
+// all but the last non-empty leaf are full and the empty ones come last.
+std::uint64_t left_count(std::uint64_t count, std::size_t capacity, unsigned levels)
+{
+    return std::min<std::uint64_t>(count, std::uint64_t{capacity} << (levels - 1));
+}
+
+void sort_by(std::vector<Point>::iterator begin, std::vector<Point>::iterator end, unsigned axis)
+{
+    if (axis == 0) {
+        std::sort(begin, end, LessX());
+    }
+    else {
+        std::sort(begin, end, LessY());
+    }
+}
+
+// Merges the sorted runs of `budget` points in [begin, begin + count) of the
+// work file into the same range of the scratch file, reading and writing
+// slices that together take `budget` points.
+void merge_runs(int work, int scratch, std::uint64_t begin, std::uint64_t count, unsigned axis, std::size_t budget)
+{
+    struct Run
+    {
+        std::uint64_t next, end;
+        std::vector<Point> data;
+        std::size_t position = 0;
+    };
+    const std::size_t runs = static_cast<std::size_t>((count + budget - 1) / budget);
+    const std::size_t slice = std::max<std::size_t>(1, budget / (runs + 1));
+    std::vector<Run> inputs;
+    for (std::uint64_t run = 0; run < count; run += budget) {
+        inputs.push_back({begin + run, begin + std::min<std::uint64_t>(count, run + budget), {}, 0});
+    }
+    auto refill = [&](Run & run) {
+        std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(slice, run.end - run.next));
+        run.data.assign(length, Point(0, 0));
+        read_points(work, run.next, length, run.data.data());
+        run.next += length;
+        run.position = 0;
+    };
+    using Head = std::pair<double, std::size_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        refill(inputs[i]);
+        heads.emplace(coordinate(inputs[i].data[0], axis), i);
+    }
+    std::vector<Point> out;
+    out.reserve(slice);
+    std::uint64_t written = begin;
+    auto flush = [&] {
+        write_points(scratch, written, out.size(), out.data());
+        written += out.size();
+        out.clear();
+    };
+    while (!heads.empty()) {
+        std::size_t i = heads.top().second;
+        heads.pop();
+        Run & run = inputs[i];
+        out.push_back(run.data[run.position++]);
+        if (out.size() == slice) {
+            flush();
+        }
+        if (run.position == run.data.size() && run.next < run.end) {
+            refill(run);
+        }
+        if (run.position < run.data.size()) {
+            heads.emplace(coordinate(run.data[run.position], axis), i);
+        }
+    }
+    flush();
+}
+
+// Orders points [begin, begin + count) of the work file by one axis: sorted
+// runs of `budget` points, then a k-way merge through the scratch file.
+// Each phase frees its buffers before the next one, so at most `budget`
+// points are held at a time.
+void external_sort(int work, int scratch, std::uint64_t begin, std::uint64_t count, unsigned axis, std::size_t budget)
+{
+    auto copy = [&](int from, int to, bool sort) {
+        std::vector<Point> buffer(static_cast<std::size_t>(std::min<std::uint64_t>(count, budget)), Point(0, 0));
+        for (std::uint64_t run = 0; run < count; run += budget) {
+            std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(budget, count - run));
+            read_points(from, begin + run, length, buffer.data());
+            if (sort) {
+                sort_by(buffer.begin(), buffer.begin() + length, axis);
+            }
+            write_points(to, begin + run, length, buffer.data());
+        }
+    };
+    copy(work, work, true);
+    if (count <= budget) {
+        return;
+    }
+    merge_runs(work, scratch, begin, count, axis, budget);
+    copy(scratch, work, false);
+}
+} // namespace
+
+BufferPool::BufferPool(int fd, std::size_t page_size, std::size_t frames)
+    : fd_(fd)
+    , page_size_(page_size)
+    , frames_(std::max<std::size_t>(frames, 2))
+    , memory_(frames_.size() * page_size)
+{
+}
+
+std::size_t BufferPool::victim()
+{
+    for (;;) {
+        std::size_t index = hand_;
+        hand_ = (hand_ + 1) % frames_.size();
+        Frame & frame = frames_[index];
+        if (frame.pinned) {
+            continue;
+        }
+        if (frame.used && frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.used) {
+            table_.erase(frame.id);
+            ++stats_.evictions;
+        }
+        return index;
+    }
+}
+
+void BufferPool::read_run(const std::uint64_t * ids, std::size_t count)
+{
+    std::vector<iovec> vectors(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t index = victim();
+        Frame & frame = frames_[index];
+        frame.id = ids[i];
+        frame.used = true;
+        frame.referenced = false;
+        frame.pinned = true;
+        table_[ids[i]] = index;
+        vectors[i] = {memory_.data() + index * page_size_, page_size_};
+    }
+    std::size_t done = 0;
+    while (done < count * page_size_) {
+        std::size_t first = done / page_size_;
+        vectors[first].iov_base = memory_.data() + table_[ids[first]] * page_size_ + done % page_size_;
+        vectors[first].iov_len = page_size_ - done % page_size_;
+        ssize_t got = ::preadv(fd_, vectors.data() + first, static_cast<int>(count - first), static_cast<off_t>(ids[0] * page_size_ + done));
+        ++stats_.read_calls;
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            throw std::runtime_error("paged::BufferPool: read failed");
+        }
+        done += static_cast<std::size_t>(got);
+    }
+    stats_.pages_read += count;
+}
+
+const char * BufferPool::page(std::uint64_t id, const std::uint64_t * ahead, std::size_t ahead_count)
+{
+    auto found = table_.find(id);
+    if (found != table_.end()) {
+        ++stats_.hits;
+        frames_[found->second].referenced = true;
+        return memory_.data() + found->second * page_size_;
+    }
+    ++stats_.misses;
+    std::vector<std::uint64_t> ids{id};
+    ids.insert(ids.end(), ahead, ahead + ahead_count);
+    prefetch(ids.data(), ids.size());
+    std::size_t index = table_[id];
+    frames_[index].referenced = true;
+    return memory_.data() + index * page_size_;
+}
+
+void BufferPool::prefetch(const std::uint64_t * ids, std::size_t count)
+{
+    std::vector<std::uint64_t> missing;
+    for (std::size_t i = 0; i < count && missing.size() + 1 < frames_.size(); ++i) {
+        if (table_.count(ids[i]) == 0) {
+            missing.push_back(ids[i]);
+        }
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    for (std::size_t begin = 0, end; begin < missing.size(); begin = end) {
+        for (end = begin + 1; end < missing.size() && missing[end] == missing[end - 1] + 1; ++end) {
+        }
+        read_run(missing.data() + begin, end - begin);
+    }
+    for (const auto id : missing) {
+        frames_[table_[id]].pinned = false;
+    }
+}
+
+void Tree::build(const std::string & points_file, const std::string & tree_file, const BuildOptions & options)
+{
+    if (options.page_size < sizeof(Point) || options.page_size % sizeof(Point) != 0) {
+        throw std::invalid_argument("paged::Tree::build: page size must be a multiple of 16 bytes");
+    }
+    const std::size_t capacity = options.page_size / sizeof(Point);
+    const std::size_t budget = std::max(capacity, options.memory_budget / sizeof(Point));
+    const std::string work_file = tree_file + ".work", scratch_file = tree_file + ".scratch";
+    int work = ::open(work_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int scratch = ::open(scratch_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int out = ::open(tree_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    auto cleanup = [&] {
+        for (int fd : {work, scratch, out}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        ::unlink(work_file.c_str());
+        ::unlink(scratch_file.c_str());
+    };
+    try {
+        if (work < 0 || scratch < 0 || out < 0) {
+            throw std::runtime_error("paged::Tree::build: cannot create " + tree_file);
+        }
+        std::uint64_t size = 0;
+        {
+            std::ifstream in(points_file, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("paged::Tree::build: cannot open " + points_file);
+            }
+            // Parsed by ingest::parse_points in blocks cut at newlines, as
+            // PointSet(filename) reads. A text line takes at least 4 bytes,
+            // so the points of a block stay within the budget. Duplicates
+            // are dropped within a block only.
+            const std::size_t block_bytes = std::min<std::size_t>(std::size_t{1} << 20, budget * sizeof(Point) / 4);
+            std::vector<char> block, carry;
+            while (in) {
+                block.swap(carry);
+                std::size_t old = block.size();
+                block.resize(old + block_bytes);
+                in.read(block.data() + old, static_cast<std::streamsize>(block.size() - old));
+                block.resize(old + static_cast<std::size_t>(in.gcount()));
+                carry.clear();
+                if (in) {
+                    auto cut = std::find(block.rbegin(), block.rend(), '\n').base();
+                    carry.assign(cut, block.end());
+                    block.erase(cut, block.end());
+                }
+                std::vector<Point> chunk = ingest::parse_points(block.data(), block.data() + block.size());
+                write_points(work, size, chunk.size(), chunk.data());
+                size += chunk.size();
+            }
+        }
+
+        unsigned depth = 0;
+        while (size != 0 && ((size - 1) >> depth) + 1 > capacity) {
+            ++depth;
+        }
+        const std::size_t internal = (std::size_t{1} << depth) - 1;
+        std::vector<double> splits(internal);
+        std::vector<char> page(options.page_size);
+
+        auto in_memory = [&](auto && self, std::size_t node, unsigned level, std::vector<Point>::iterator begin, std::size_t count) -> void {
+            if (count == 0) {
+                return;
+            }
+            if (level == depth) {
+                std::fill(page.begin(), page.end(), 0);
+                std::memcpy(page.data(), &*begin, count * sizeof(Point));
+                write_exact(out, page.data(), page.size(), (1 + node - internal) * options.page_size);
+                return;
+            }
+            const unsigned axis = level % 2;
+            const std::size_t left = static_cast<std::size_t>(left_count(count, capacity, depth - level));
+            if (left == count) {
+                // Nothing on the right: the left cell is unbounded.
+                splits[node] = INF;
+            }
+            else {
+                if (axis == 0) {
+                    std::nth_element(begin, begin + left, begin + count, LessX());
+                }
+                else {
+                    std::nth_element(begin, begin + left, begin + count, LessY());
+                }
+                splits[node] = coordinate(*(begin + left), axis);
+            }
+            self(self, 2 * node + 1, level + 1, begin, left);
+            self(self, 2 * node + 2, level + 1, begin + left, count - left);
+        };
+        auto external = [&](auto && self, std::size_t node, unsigned level, std::uint64_t begin, std::uint64_t count) -> void {
+            if (count <= budget) {
+                std::vector<Point> points(count, Point(0, 0));
+                read_points(work, begin, count, points.data());
+                in_memory(in_memory, node, level, points.begin(), count);
+                return;
+            }
+            const unsigned axis = level % 2;
+            const std::uint64_t left = left_count(count, capacity, depth - level);
+            if (left == count) {
+                splits[node] = INF;
+            }
+            else {
+                external_sort(work, scratch, begin, count, axis, budget);
+                Point split(0, 0);
+                read_points(work, begin + left, 1, &split);
+                splits[node] = coordinate(split, axis);
+            }
+            self(self, 2 * node + 1, level + 1, begin, left);
+            self(self, 2 * node + 2, level + 1, begin + left, count - left);
+        };
+        external(external, 0, 0, 0, size);
+
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.size = size;
+        header.depth = depth;
+        header.page_size = options.page_size;
+        // Only the non-empty leaves, which come first, take pages.
+        header.directory = (1 + (size + capacity - 1) / capacity) * options.page_size;
+        write_exact(out, splits.data(), splits.size() * sizeof(double), header.directory);
+        std::fill(page.begin(), page.end(), 0);
+        std::memcpy(page.data(), &header, sizeof(header));
+        write_exact(out, page.data(), page.size(), 0);
+    }
+    catch (...) {
+        cleanup();
+        throw;
+    }
+    cleanup();
+}
+
+Tree::Tree(const std::string & tree_file, std::size_t pool_pages, std::size_t readahead)
+    : fd_(::open(tree_file.c_str(), O_RDONLY))
+{
+    if (fd_ < 0) {
+        throw std::runtime_error("paged::Tree: cannot open " + tree_file);
+    }
+    Header header;
+    try {
+        read_exact(fd_, &header, sizeof(header), 0);
+    }
+    catch (const std::runtime_error &) {
+        ::close(fd_);
+        throw std::runtime_error("paged::Tree: not a tree file: " + tree_file);
+    }
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.depth >= 48) {
+        ::close(fd_);
+        throw std::runtime_error("paged::Tree: not a tree file: " + tree_file);
+    }
+    size_ = header.size;
+    depth_ = static_cast<unsigned>(header.depth);
+    page_size_ = header.page_size;
+    splits_.resize((std::size_t{1} << depth_) - 1);
+    read_exact(fd_, splits_.data(), splits_.size() * sizeof(double), header.directory);
+    pool_ = std::make_unique<BufferPool>(fd_, page_size_, pool_pages);
+    readahead_ = std::min(readahead, pool_->frames() / 2);
+}
+
+Tree::~Tree()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+const Point * Tree::leaf(std::size_t index)
+{
+    return reinterpret_cast<const Point *>(pool_->page(1 + index));
+}
+
+template <class F>
+void Tree::leaves(const Rect & rect, F && f) const
+{
+    auto visit = [&](auto && self, std::size_t node, unsigned level, std::size_t count, const Rect & cell) -> void {
+        if (count == 0 || !rect.intersects(cell)) {
+            return;
+        }
+        if (level == depth_) {
+            f(node - splits_.size(), count);
+            return;
+        }
+        const double split = splits_[node];
+        const std::size_t half = left_count(count, page_size_ / sizeof(Point), depth_ - level);
+        if (level % 2 == 0) {
+            self(self, 2 * node + 1, level + 1, half, Rect(cell.left_bottom(), {split, cell.ymax()}));
+            self(self, 2 * node + 2, level + 1, count - half, Rect({split, cell.ymin()}, cell.right_top()));
+        }
+        else {
+            self(self, 2 * node + 1, level + 1, half, Rect(cell.left_bottom(), {cell.xmax(), split}));
+            self(self, 2 * node + 2, level + 1, count - half, Rect({cell.xmin(), split}, cell.right_top()));
+        }
+    };
+    visit(visit, 0, 0, size_, Rect({-INF, -INF}, {INF, INF}));
+}
+
+bool Tree::contains(const Point & key)
+{
+    bool found = false;
+    leaves(Rect(key, key), [&](std::size_t index, std::size_t count) {
+        const Point * points = leaf(index);
+        for (std::size_t i = 0; i < count && !found; ++i) {
+            found = points[i] == key;
+        }
+    });
+    return found;
+}
+
+std::vector<Point> Tree::range(const Rect & rect)
+{
+    std::vector<std::uint64_t> pages;
+    std::vector<std::size_t> counts;
+    leaves(rect, [&](std::size_t index, std::size_t count) {
+        pages.push_back(1 + index);
+        counts.push_back(count);
+    });
+    std::vector<Point> result;
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        const std::size_t ahead = std::min(readahead_, pages.size() - i - 1);
+        const Point * points = reinterpret_cast<const Point *>(pool_->page(pages[i], pages.data() + i + 1, ahead));
+        for (std::size_t j = 0; j < counts[i]; ++j) {
+            if (rect.contains(points[j])) {
+                result.push_back(points[j]);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<Point> Tree::nearest(const Point & key, std::size_t k)
+{
+    std::vector<Point> result;
+    if (size_ == 0 || k == 0) {
+        return result;
+    }
+    struct Pending
+    {
+        double distance;
+        std::size_t node;
+        unsigned level;
+        std::size_t count;
+        Rect cell;
+        bool operator<(const Pending & another) const
+        {
+            return distance > another.distance;
+        }
+    };
+    using Candidate = std::pair<double, Point>;
+    auto farther = [](const Candidate & a, const Candidate & b) { return a.first < b.first; };
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(farther)> best(farther);
+    std::priority_queue<Pending> cells;
+    cells.push({0, 0, 0, size_, Rect({-INF, -INF}, {INF, INF})});
+    while (!cells.empty() && (best.size() < k || cells.top().distance <= best.top().first)) {
+        Pending now = cells.top();
+        cells.pop();
+        if (now.level == depth_) {
+            const Point * points = leaf(now.node - splits_.size());
+            for (std::size_t i = 0; i < now.count; ++i) {
+                double distance = key.distance(points[i]);
+                if (best.size() < k) {
+                    best.emplace(distance, points[i]);
+                }
+                else if (distance < best.top().first) {
+                    best.pop();
+                    best.emplace(distance, points[i]);
+                }
+            }
+            continue;
+        }
+        const double split = splits_[now.node];
+        const std::size_t half = left_count(now.count, page_size_ / sizeof(Point), depth_ - now.level);
+        Rect left = now.level % 2 == 0 ? Rect(now.cell.left_bottom(), {split, now.cell.ymax()}) : Rect(now.cell.left_bottom(), {now.cell.xmax(), split});
+        Rect right = now.level % 2 == 0 ? Rect({split, now.cell.ymin()}, now.cell.right_top()) : Rect({now.cell.xmin(), split}, now.cell.right_top());
+        if (half != 0) {
+            cells.push({left.distance(key), 2 * now.node + 1, now.level + 1, half, left});
+        }
+        if (now.count != half) {
+            cells.push({right.distance(key), 2 * now.node + 2, now.level + 1, now.count - half, right});
+        }
+    }
+    result.resize(best.size(), Point(0, 0));
+    for (std::size_t i = result.size(); i-- > 0; best.pop()) {
+        result[i] = best.top().second;
+    }
+    return result;
+}
+
+} // namespace paged
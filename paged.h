@@ -0,0 +1,150 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace paged {
+
+struct IoStats
+{
+    std::size_t hits = 0;        // page requests served from the pool
+    std::size_t misses = 0;      // page requests that had to wait for a read
+    std::size_t pages_read = 0;  // including readahead
+    std::size_t read_calls = 0;  // preadv() calls
+    std::size_t evictions = 0;
+
+    friend std::ostream & operator<<(std::ostream & out, const IoStats & stats)
+    {
+        return out << "hits " << stats.hits << ", misses " << stats.misses << ", pages read " << stats.pages_read
+                   << ", read calls " << stats.read_calls << ", evictions " << stats.evictions;
+    }
+};
+
+/*
+ * Fixed number of page frames over a file, with CLOCK eviction. A page
+ * returned by page() stays valid until the next call into the pool.
+ */
+class BufferPool
+{
+public:
+    BufferPool(int fd, std::size_t page_size, std::size_t frames);
+
+    // On a miss, the missing pages among `ahead` are read in the same pass.
+    const char * page(std::uint64_t id, const std::uint64_t * ahead = nullptr, std::size_t ahead_count = 0);
+    // Reads the missing pages among ids, merging runs of consecutive pages
+    // into one call each.
+    void prefetch(const std::uint64_t * ids, std::size_t count);
+    bool resident(std::uint64_t id) const
+    {
+        return table_.count(id) != 0;
+    }
+    std::size_t frames() const
+    {
+        return frames_.size();
+    }
+
+    const IoStats & stats() const
+    {
+        return stats_;
+    }
+    void reset_stats()
+    {
+        stats_ = {};
+    }
+
+private:
+    struct Frame
+    {
+        std::uint64_t id;
+        bool used = false;
+        bool referenced = false;
+        bool pinned = false;
+    };
+
+    std::size_t victim();
+    void read_run(const std::uint64_t * ids, std::size_t count);
+
+    int fd_;
+    std::size_t page_size_;
+    std::vector<Frame> frames_;
+    std::vector<char> memory_;
+    std::unordered_map<std::uint64_t, std::size_t> table_;
+    std::size_t hand_ = 0;
+    IoStats stats_;
+};
+
+/*
+ * Disk-resident kd-tree. Points live in fixed-size leaf pages; only the
+ * split values of the internal nodes stay in memory. The layout is
+ * implicit (the left subtree is packed full before the right one gets any
+ * points, axes alternate), so a leaf's page number and point count follow
+ * from its position, and the empty leaves at the end take no pages. Range queries
+ * find all leaf pages first and read ahead along them; nearest() visits
+ * pages best-first. build() works under a memory budget: ranges that do not
+ * fit are ordered with an external merge sort, and subtrees that fit are
+ * finished in memory.
+ */
+class Tree
+{
+public:
+    struct BuildOptions
+    {
+        std::size_t page_size = 4096;
+        std::size_t memory_budget = std::size_t{256} << 20; // bytes
+    };
+
+    // Builds a tree file from a text file of "x y" lines, in the format of
+    // ingest::parse_points.
+    static void build(const std::string & points_file, const std::string & tree_file, const BuildOptions & options);
+    static void build(const std::string & points_file, const std::string & tree_file)
+    {
+        build(points_file, tree_file, BuildOptions());
+    }
+
+    Tree(const std::string & tree_file, std::size_t pool_pages = 1024, std::size_t readahead = 32);
+    ~Tree();
+    Tree(const Tree &) = delete;
+    Tree & operator=(const Tree &) = delete;
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    std::size_t page_size() const
+    {
+        return page_size_;
+    }
+
+    bool contains(const Point &);
+    std::vector<Point> range(const Rect &);
+    // The k nearest points, closest first.
+    std::vector<Point> nearest(const Point &, std::size_t k);
+
+    const IoStats & io_stats() const
+    {
+        return pool_->stats();
+    }
+    void reset_io_stats()
+    {
+        pool_->reset_stats();
+    }
+
+private:
+    template <class F>
+    void leaves(const Rect &, F && f) const;
+    const Point * leaf(std::size_t index);
+
+    int fd_ = -1;
+    std::size_t size_ = 0;
+    unsigned depth_ = 0;
+    std::size_t page_size_ = 0;
+    std::size_t readahead_;
+    std::vector<double> splits_; // internal nodes, heap order
+    std::unique_ptr<BufferPool> pool_;
+};
+
+} // namespace paged
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace pointhash {
+
+/*
+ * Open-addressing hash set of coordinate pairs, compared by bit pattern
+ * (with -0.0 folded into 0.0, so that it agrees with exact comparison).
+ * Linear probing; erase shifts the following entries back instead of
+ * leaving tombstones, so probe runs stay short under churn.
+ */
+class Table
+{
+public:
+    bool contains(double x, double y) const
+    {
+        if (size_ == 0) {
+            return false;
+        }
+        const Key key = make_key(x, y);
+        for (std::size_t i = hash(key) & mask(); slots_[i].used; i = (i + 1) & mask()) {
+            if (slots_[i].key.x == key.x && slots_[i].key.y == key.y) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns false if the pair was already there.
+    bool insert(double x, double y)
+    {
+        if (2 * (size_ + 1) > slots_.size()) {
+            rehash(slots_.empty() ? 16 : 2 * slots_.size());
+        }
+        const Key key = make_key(x, y);
+        std::size_t i = hash(key) & mask();
+        for (; slots_[i].used; i = (i + 1) & mask()) {
+            if (slots_[i].key.x == key.x && slots_[i].key.y == key.y) {
+                return false;
+            }
+        }
+        slots_[i] = {key, true};
+        ++size_;
+        return true;
+    }
+
+    bool erase(double x, double y)
+    {
+        if (size_ == 0) {
+            return false;
+        }
+        const Key key = make_key(x, y);
+        std::size_t i = hash(key) & mask();
+        for (; slots_[i].used; i = (i + 1) & mask()) {
+            if (slots_[i].key.x == key.x && slots_[i].key.y == key.y) {
+                break;
+            }
+        }
+        if (!slots_[i].used) {
+            return false;
+        }
+        // Move back every later entry of the run whose home slot is not
+        // between the hole and itself.
+        for (std::size_t j = (i + 1) & mask(); slots_[j].used; j = (j + 1) & mask()) {
+            const std::size_t home = hash(slots_[j].key) & mask();
+            if (((j - home) & mask()) >= ((j - i) & mask())) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].used = false;
+        --size_;
+        return true;
+    }
+
+    void reserve(std::size_t count)
+    {
+        std::size_t capacity = 16;
+        while (capacity < 2 * count) {
+            capacity *= 2;
+        }
+        if (capacity > slots_.size()) {
+            rehash(capacity);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    std::size_t memory_bytes() const
+    {
+        return slots_.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Key
+    {
+        std::uint64_t x, y;
+    };
+
+    struct Slot
+    {
+        Key key;
+        bool used;
+    };
+
+    static Key make_key(double x, double y)
+    {
+        Key key;
+        x += 0.0;
+        y += 0.0;
+        std::memcpy(&key.x, &x, sizeof(x));
+        std::memcpy(&key.y, &y, sizeof(y));
+        return key;
+    }
+
+    static std::size_t hash(const Key & key)
+    {
+        std::uint64_t h = key.x * 0x9E3779B97F4A7C15ull ^ (key.y + 0x632BE59BD9B4E019ull);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return static_cast<std::size_t>(h);
+    }
+
+    std::size_t mask() const
+    {
+        return slots_.size() - 1;
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        std::vector<Slot> old(capacity, Slot{{0, 0}, false});
+        old.swap(slots_);
+        for (const Slot & slot : old) {
+            if (slot.used) {
+                std::size_t i = hash(slot.key) & mask();
+                while (slots_[i].used) {
+                    i = (i + 1) & mask();
+                }
+                slots_[i] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::size_t size_ = 0;
+};
+
+} // namespace pointhash
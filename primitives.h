@@ -1,12 +1,17 @@
 #pragma once
 
+#include "latency.h"
 #include "mpool.h"
+#include "pointhash.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <array>
 #include <climits>
 #include <cmath>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -20,9 +25,15 @@ const double INF = std::numeric_limits<double>::infinity();
 namespace {
 const double EPS = std::numeric_limits<double>::epsilon();
 
+// Coordinates compare exactly unless POINT_APPROX_COMPARE restores the old
+// absolute-epsilon behaviour.
 bool double_equal(double x, double y)
 {
+#ifdef POINT_APPROX_COMPARE
     return std::abs(x - y) < EPS;
+#else
+    return x == y;
+#endif
 }
 } // namespace
 
@@ -52,6 +63,7 @@ public:
 
     bool operator<(const Point & another) const
     {
+#ifdef POINT_APPROX_COMPARE
         if (double_equal(this->x(), another.x())) {
             if (double_equal(this->y(), another.y())) {
                 return false;
@@ -59,16 +71,19 @@ public:
             return this->y() < another.y();
         }
         return this->x() < another.x();
+#else
+        return (x_ < another.x_) | ((x_ == another.x_) & (y_ < another.y_));
+#endif
     }
 
     bool operator>(const Point & another) const
     {
-        return !this->operator<=(another);
+        return another.operator<(*this);
     }
 
     bool operator<=(const Point & another) const
     {
-        return this->operator==(another) || this->operator<(another);
+        return !another.operator<(*this);
     }
 
     bool operator>=(const Point & another) const
@@ -78,7 +93,7 @@ public:
 
     bool operator==(const Point & another) const
     {
-        return double_equal(this->x(), another.x()) && double_equal(this->y(), another.y());
+        return double_equal(this->x(), another.x()) & double_equal(this->y(), another.y());
     }
 
     bool operator!=(const Point & another) const
@@ -96,6 +111,32 @@ private:
     double x_, y_;
 };
 
+// Branch-free strict orders for sorting; with exact comparisons they agree
+// with Point::operator< and operator==.
+struct LessXY
+{
+    bool operator()(const Point & a, const Point & b) const
+    {
+        return (a.x() < b.x()) | ((a.x() == b.x()) & (a.y() < b.y()));
+    }
+};
+
+struct LessX
+{
+    bool operator()(const Point & a, const Point & b) const
+    {
+        return a.x() < b.x();
+    }
+};
+
+struct LessY
+{
+    bool operator()(const Point & a, const Point & b) const
+    {
+        return a.y() < b.y();
+    }
+};
+
 class Rect
 {
 public:
@@ -137,19 +178,12 @@ public:
     {
         return right_top_.y();
     }
+    // Zero inside, otherwise the distance to the nearest edge or corner.
     double distance(const Point & point) const
     {
-        if (contains(point)) {
-            return 0;
-        }
-        std::array<double, 6> array = {
-                point.distance({xmin(), ymin()}),
-                point.distance({xmin(), ymax()}),
-                point.distance({xmax(), ymin()}),
-                point.distance({xmax(), ymax()}),
-                ((point.x() <= xmax() && point.x() >= xmin()) ? std::min(std::abs(point.y() - ymin()), std::abs(point.y() - ymax())) : INF),
-                ((point.y() <= ymax() && point.y() >= ymin()) ? std::min(std::abs(point.x() - xmin()), std::abs(point.x() - xmax())) : INF)};
-        return *std::min_element(array.begin(), array.end());
+        double dx = std::max({xmin() - point.x(), 0.0, point.x() - xmax()});
+        double dy = std::max({ymin() - point.y(), 0.0, point.y() - ymax()});
+        return std::hypot(dx, dy);
     }
 
     bool contains(const Point & point) const
@@ -158,28 +192,20 @@ public:
                 point.y() <= ymax() && point.y() >= ymin();
     }
 
+    // Closed intervals overlap on both axes; touching edges count.
     bool intersects(const Rect & another) const
     {
-        return intersects_impl(another) || another.intersects_impl(*this);
+        return xmin() <= another.xmax() && another.xmin() <= xmax() &&
+                ymin() <= another.ymax() && another.ymin() <= ymax();
     }
 
 private:
-    bool intersects_impl(const Rect & another) const
-    {
-        return contains({another.xmin(), another.ymin()}) ||
-                contains({another.xmin(), another.ymax()}) ||
-                contains({another.xmax(), another.ymin()}) ||
-                contains({another.xmax(), another.ymax()});
-    }
-
     Point left_bottom_, right_top_;
 };
 
 using map_node = std::_Rb_tree_node<std::pair<double, Point>>;
-using point_map = std::map<double, Point, std::less<double>, PoolAllocator<map_node>>;
-
-
-} // namespace rbtree
+// A multimap, so that points at equal distance from the key are all kept.
+using point_map = std::multimap<double, Point, std::less<double>, PoolAllocator<std::pair<const double, Point>>>;
 
 namespace kdtree {
 
@@ -204,7 +230,8 @@ class PointSet
         Point point;
         Orientation orientation;
         std::shared_ptr<Node> left, right;
-        size_t size;
+        size_t size; // live points in the subtree
+        bool erased = false;
 
         Node(const Point & point_, Orientation orientation_)
             : point(point_)
@@ -220,11 +247,34 @@ class PointSet
 
     std::shared_ptr<Node> save_tree(const std::set<Point> & points) const;
 
-    void range_impl(const Rect & rect, const std::shared_ptr<Node> & node_now, std::set<Point> & ans_set, const Rect & rect_now) const;
+    void range_impl(const Rect & rect, const std::shared_ptr<Node> & node_now, std::set<Point> & ans_set, const Rect & rect_now, QueryStats & stats, std::size_t depth) const;
 
-    void nearest_impl(const Point & key, size_t k, const std::shared_ptr<Node> & node_now, point_map & ans_map, const Rect & rect_now) const;
+    void nearest_impl(const Point & key, size_t k, const std::shared_ptr<Node> & node_now, point_map & ans_map, const Rect & rect_now, QueryStats & stats, std::size_t depth) const;
 
-    void balancing(std::vector<Point>::iterator begin, std::vector<Point>::iterator end, Orientation now);
+    // `covered` holds the rects that contain the whole cell, `active` those
+    // that only overlap it.
+    void multi_range_impl(const std::vector<Rect> & rects, const Node * node, std::uint64_t covered, std::uint64_t active, const Rect & rect_now, std::vector<std::pair<Point, std::uint64_t>> & result) const;
+
+    // Builds a balanced subtree from distinct points, splitting the work
+    // across up to `threads` threads.
+    std::shared_ptr<Node> balancing(std::vector<Point>::iterator begin, std::vector<Point>::iterator end, Orientation now, unsigned threads);
+
+    void put_impl(const Point &);
+    void tree_put(const Point &);
+    // Adds one to (or takes one from) the sizes on the path to key, down to
+    // the node holding it if there is one.
+    void adjust_sizes(const Point & key, bool grow);
+    void revive(Node * node);
+    void drop_tombstones();
+
+    // Small sets live in `flat` and are answered by linear scans; the tree is
+    // built once the set grows past flat_limit.
+    void grow_tree();
+    bool flat_contains(const Point &) const;
+    Point snapped(const Point &) const;
+    const Node * find_within(const Point & key, const Node * node) const;
+    void merge(const Point & stored, const Point & incoming) const;
+    std::shared_ptr<const std::vector<Point>> flat_nearest(const Point &, std::size_t k, QueryStats &) const;
 
 public:
     class iterator
@@ -242,31 +292,42 @@ public:
 
         iterator(const std::shared_ptr<Node> & node)
             : now(node)
+        {
+            skip_erased();
+        }
+
+        iterator(const Point * begin, const Point * end)
+            : flat_now(begin)
+            , flat_end(end)
         {
         }
 
-        reference operator*() const { return now->point; }
-        pointer operator->() const { return &(now->point); }
+        // Iterates over query results that the iterator keeps alive.
+        iterator(std::shared_ptr<const std::vector<Point>> points)
+            : flat_now(points->data())
+            , flat_end(points->data() + points->size())
+            , flat_owner(std::move(points))
+        {
+        }
+
+        reference operator*() const { return flat_now ? *flat_now : now->point; }
+        pointer operator->() const { return flat_now ? flat_now : &(now->point); }
 
         // Prefix increment
         iterator & operator++()
         {
-            if (now == nullptr) {
+            if (flat_now != nullptr) {
+                if (++flat_now == flat_end) {
+                    flat_now = flat_end = nullptr;
+                    flat_owner = nullptr;
+                }
                 return *this;
             }
-            if (now->left) {
-                queue.push_back(now->left);
-            }
-            if (now->right) {
-                queue.push_back(now->right);
-            }
-            if (queue.empty()) {
-                now = nullptr;
-            }
-            else {
-                now = queue.front();
-                queue.pop_front();
+            if (now == nullptr) {
+                return *this;
             }
+            step();
+            skip_erased();
             return *this;
         }
 
@@ -280,7 +341,7 @@ public:
 
         friend bool operator==(const iterator & a, const iterator & b)
         {
-            return a.now == b.now;
+            return a.now == b.now && a.flat_now == b.flat_now;
         };
         friend bool operator!=(const iterator & a, const iterator & b)
         {
@@ -288,21 +349,114 @@ public:
         };
 
     private:
-        std::deque<std::shared_ptr<Node>> queue;
+        void step()
+        {
+            if (now->left) {
+                queue.push_back(now->left);
+            }
+            if (now->right) {
+                queue.push_back(now->right);
+            }
+            if (head == queue.size()) {
+                now = nullptr;
+                queue.clear();
+                head = 0;
+            }
+            else {
+                now = std::move(queue[head++]);
+            }
+        }
+
+        void skip_erased()
+        {
+            while (now != nullptr && now->erased) {
+                step();
+            }
+        }
+
+        // BFS queue; a vector (unlike std::deque) does not allocate until the
+        // first push, which keeps small result iterators cheap.
+        std::vector<std::shared_ptr<Node>> queue;
+        std::size_t head = 0;
         std::shared_ptr<Node> now;
+        const Point * flat_now = nullptr;
+        const Point * flat_end = nullptr;
+        std::shared_ptr<const std::vector<Point>> flat_owner;
     };
 
+    // Sets of up to this many points are stored as a flat array.
+    static constexpr std::size_t default_flat_limit = 128;
+
     PointSet(const std::string & filename = {});
+    // Duplicates are dropped. The tree is built by up to `threads` threads;
+    // 0 means one per hardware thread.
+    explicit PointSet(std::vector<Point> points, unsigned threads = 0);
+
+    // Iterators from begin() are invalidated by put() while the set is flat.
+    void set_flat_limit(std::size_t limit);
+    std::size_t flat_limit() const
+    {
+        return flat_limit_;
+    }
+
+    // Rounds coordinates to multiples of step in put() and contains(), so that
+    // points closer than the step collapse into one; 0 (the default) disables
+    // it. Points already stored are not moved.
+    void set_snap(double step)
+    {
+        snap_ = step;
+    }
+    double snap() const
+    {
+        return snap_;
+    }
+
+    // A put() that lands within tolerance of a stored point is merged into it
+    // instead of being inserted, and on_merge(stored, incoming) is called so
+    // that the caller can combine payloads. 0 (the default) keeps only exact
+    // duplicates out.
+    using MergeCallback = std::function<void(const Point & stored, const Point & incoming)>;
+    void set_merge_tolerance(double tolerance, MergeCallback on_merge = {})
+    {
+        merge_tolerance_ = tolerance;
+        on_merge_ = std::move(on_merge);
+    }
+    double merge_tolerance() const
+    {
+        return merge_tolerance_;
+    }
+
+    // Keeps a hash set of the stored points next to the tree, so that
+    // contains() is one probe and put() turns duplicates away without a
+    // descent. Costs 48 to 96 bytes per point.
+    void set_hash_index(bool enabled);
+    bool hash_index() const
+    {
+        return hash_.has_value();
+    }
 
     bool empty() const;
     std::size_t size() const;
+    TreeStats stats() const;
     void put(const Point &);
+    // Returns whether the point was there. Erased tree nodes stay behind as
+    // tombstones until they outnumber the live points, then the tree is
+    // rebuilt without them.
+    bool erase(const Point &);
     bool contains(const Point &) const;
 
     std::pair<iterator, iterator> range(const Rect &) const;
+    std::pair<iterator, iterator> range(const Rect &, QueryStats &) const;
+    // Answers up to 64 rects in one traversal: every point inside any of
+    // them comes back once, in order, with bit i set if rects[i] holds it.
+    // Throws std::length_error for more rects.
+    std::vector<std::pair<Point, std::uint64_t>> range(const std::vector<Rect> & rects) const;
 
     iterator begin() const
     {
+        if (root == nullptr && !flat.empty()) {
+            return {flat.data(), flat.data() + flat.size()};
+        }
         return root;
     }
     iterator end() const
@@ -312,11 +466,34 @@ public:
 
     std::optional<Point> nearest(const Point &) const;
     std::pair<iterator, iterator> nearest(const Point &, std::size_t) const;
+    std::pair<iterator, iterator> nearest(const Point &, std::size_t, QueryStats &) const;
+
+#ifdef KDTREE_TRAVERSAL_STATS
+    // Histograms over every query answered so far.
+    const TraversalStats & traversal_stats() const
+    {
+        return traversal_stats_;
+    }
+    void reset_traversal_stats()
+    {
+        traversal_stats_ = {};
+    }
+#endif
 
     friend std::ostream & operator<<(std::ostream &, const PointSet &);
 
 private:
     std::shared_ptr<Node> root;
+    std::vector<Point> flat;
+    std::size_t tombstones_ = 0;
+    std::size_t flat_limit_ = default_flat_limit;
+    double snap_ = 0;
+    double merge_tolerance_ = 0;
+    MergeCallback on_merge_;
+    std::optional<pointhash::Table> hash_;
+#ifdef KDTREE_TRAVERSAL_STATS
+    mutable TraversalStats traversal_stats_;
+#endif
     //mutable std::vector<std::shared_ptr<Node>> quarries;
 };
 
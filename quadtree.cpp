@@ -0,0 +1,440 @@
+#include "quadtree.h"
+
+#include "ingest.h"
+#include "rectbatch.h"
+
+#include <cmath>
+#include <queue>
+#include <stdexcept>
+
+namespace quadtree {
+using iterator = PointSet::iterator;
+
+namespace {
+double cell_distance(double cx, double cy, double half, const Point & key)
+{
+    double dx = std::max(std::abs(key.x() - cx) - half, 0.0);
+    double dy = std::max(std::abs(key.y() - cy) - half, 0.0);
+    return std::hypot(dx, dy);
+}
+
+bool overlaps(const Rect & key, const Rect & cell)
+{
+    return key.xmin() <= cell.xmax() && key.xmax() >= cell.xmin() &&
+            key.ymin() <= cell.ymax() && key.ymax() >= cell.ymin();
+}
+
+bool covers(const Rect & key, const Rect & cell)
+{
+    return key.xmin() <= cell.xmin() && key.xmax() >= cell.xmax() &&
+            key.ymin() <= cell.ymin() && key.ymax() >= cell.ymax();
+}
+} // namespace
+
+PointSet::PointSet(const std::string & filename)
+    : leaves(std::make_unique<pool::FreeListPool>(sizeof(Leaf)))
+    , internals(std::make_unique<pool::FreeListPool>(sizeof(Internal)))
+{
+    if (!filename.empty()) {
+        for (const auto & point : ingest::read_points(filename)) {
+            put(point);
+        }
+    }
+}
+
+PointSet::PointSet(PointSet && another) noexcept
+    : leaves(std::move(another.leaves))
+    , internals(std::move(another.internals))
+    , root(another.root)
+{
+    another.root = nullptr;
+}
+
+PointSet & PointSet::operator=(PointSet && another) noexcept
+{
+    std::swap(leaves, another.leaves);
+    std::swap(internals, another.internals);
+    std::swap(root, another.root);
+    return *this;
+}
+
+PointSet::~PointSet()
+{
+    destroy(root);
+}
+
+PointSet::Leaf * PointSet::make_leaf(double cx, double cy, double half)
+{
+    Leaf * leaf = new (leaves->allocate()) Leaf;
+    leaf->cx = cx;
+    leaf->cy = cy;
+    leaf->half = half;
+    leaf->size = 0;
+    leaf->leaf = true;
+    leaf->count = 0;
+    return leaf;
+}
+
+PointSet::Internal * PointSet::make_internal(double cx, double cy, double half)
+{
+    Internal * internal = new (internals->allocate()) Internal;
+    internal->cx = cx;
+    internal->cy = cy;
+    internal->half = half;
+    internal->size = 0;
+    internal->leaf = false;
+    std::fill(std::begin(internal->child), std::end(internal->child), nullptr);
+    return internal;
+}
+
+void PointSet::destroy(Node * node)
+{
+    if (node == nullptr) {
+        return;
+    }
+    if (node->leaf) {
+        auto * leaf = static_cast<Leaf *>(node);
+        leaf->~Leaf();
+        leaves->deallocate(leaf);
+    }
+    else {
+        auto * internal = static_cast<Internal *>(node);
+        for (Node * child : internal->child) {
+            destroy(child);
+        }
+        internal->~Internal();
+        internals->deallocate(internal);
+    }
+}
+
+bool PointSet::empty() const
+{
+    return root == nullptr || root->size == 0;
+}
+
+std::size_t PointSet::size() const
+{
+    return root ? root->size : 0;
+}
+
+std::size_t PointSet::memory_bytes() const
+{
+    return leaves->capacity_bytes() + internals->capacity_bytes();
+}
+
+void PointSet::grow_root(const Point & key)
+{
+    double half = root->half;
+    double cx = root->cx + (key.x() < root->cx ? -half : half);
+    double cy = root->cy + (key.y() < root->cy ? -half : half);
+    Internal * grown = make_internal(cx, cy, 2 * half);
+    grown->size = root->size;
+    grown->child[quadrant(*grown, {root->cx, root->cy})] = root;
+    root = grown;
+}
+
+PointSet::Internal * PointSet::split(Leaf * leaf)
+{
+    Internal * internal = make_internal(leaf->cx, leaf->cy, leaf->half);
+    internal->size = leaf->size;
+    double half = leaf->half / 2;
+    for (std::size_t i = 0; i < leaf->count; ++i) {
+        std::size_t q = quadrant(*internal, {leaf->xs[i], leaf->ys[i]});
+        Node *& child = internal->child[q];
+        if (child == nullptr) {
+            child = make_leaf(leaf->cx + (q & 1 ? half : -half), leaf->cy + (q & 2 ? half : -half), half);
+        }
+        auto * target = static_cast<Leaf *>(child);
+        target->xs[target->count] = leaf->xs[i];
+        target->ys[target->count] = leaf->ys[i];
+        ++target->count;
+        ++target->size;
+    }
+    leaf->~Leaf();
+    leaves->deallocate(leaf);
+    return internal;
+}
+
+void PointSet::put(const Point & key)
+{
+    if (!std::isfinite(key.x()) || !std::isfinite(key.y())) {
+        throw std::domain_error("quadtree::PointSet::put: coordinates must be finite");
+    }
+    if (contains(key)) {
+        return;
+    }
+    if (root == nullptr) {
+        root = make_leaf(key.x(), key.y(), 1.0);
+    }
+    while (std::abs(key.x() - root->cx) >= root->half || std::abs(key.y() - root->cy) >= root->half) {
+        grow_root(key);
+    }
+    Node ** slot = &root;
+    std::size_t depth = 0;
+    while (true) {
+        Node * node = *slot;
+        if (node->leaf) {
+            auto * leaf = static_cast<Leaf *>(node);
+            if (leaf->count < bucket_capacity) {
+                leaf->xs[leaf->count] = key.x();
+                leaf->ys[leaf->count] = key.y();
+                ++leaf->count;
+                ++leaf->size;
+                return;
+            }
+            if (depth >= max_depth) {
+                leaf->overflow.push_back(key);
+                ++leaf->size;
+                return;
+            }
+            *slot = node = split(leaf);
+        }
+        auto * internal = static_cast<Internal *>(node);
+        ++internal->size;
+        std::size_t q = quadrant(*internal, key);
+        Node *& child = internal->child[q];
+        if (child == nullptr) {
+            double half = internal->half / 2;
+            child = make_leaf(internal->cx + (q & 1 ? half : -half), internal->cy + (q & 2 ? half : -half), half);
+        }
+        slot = &child;
+        ++depth;
+    }
+}
+
+bool PointSet::leaf_contains(const Leaf & leaf, const Point & key) const
+{
+    bool found = false;
+    for (std::size_t i = 0; i < leaf.count; ++i) {
+        found |= double_equal(leaf.xs[i], key.x()) & double_equal(leaf.ys[i], key.y());
+    }
+    for (const auto & point : leaf.overflow) {
+        found |= (point == key);
+    }
+    return found;
+}
+
+bool PointSet::contains(const Point & key) const
+{
+    const Node * node = root;
+    if (node == nullptr || std::abs(key.x() - node->cx) > node->half || std::abs(key.y() - node->cy) > node->half) {
+        return false;
+    }
+    while (node != nullptr && !node->leaf) {
+        node = static_cast<const Internal *>(node)->child[quadrant(*node, key)];
+    }
+    return node != nullptr && leaf_contains(*static_cast<const Leaf *>(node), key);
+}
+
+void PointSet::report(const Node * node, std::vector<Point> & result)
+{
+    if (node == nullptr) {
+        return;
+    }
+    if (node->leaf) {
+        const auto * leaf = static_cast<const Leaf *>(node);
+        for (std::size_t i = 0; i < leaf->count; ++i) {
+            result.emplace_back(leaf->xs[i], leaf->ys[i]);
+        }
+        result.insert(result.end(), leaf->overflow.begin(), leaf->overflow.end());
+        return;
+    }
+    for (const Node * child : static_cast<const Internal *>(node)->child) {
+        report(child, result);
+    }
+}
+
+void PointSet::range_impl(const Rect & key, const Node * node, std::vector<Point> & result) const
+{
+    if (node == nullptr) {
+        return;
+    }
+    Rect rect = cell(*node);
+    if (!overlaps(key, rect)) {
+        return;
+    }
+    if (covers(key, rect)) {
+        report(node, result);
+        return;
+    }
+    if (node->leaf) {
+        const auto * leaf = static_cast<const Leaf *>(node);
+        std::uint32_t hits[bucket_capacity];
+        std::size_t count = rectbatch::contains(key, {leaf->xs, leaf->ys, leaf->count}, hits);
+        for (std::size_t i = 0; i < count; ++i) {
+            result.emplace_back(leaf->xs[hits[i]], leaf->ys[hits[i]]);
+        }
+        for (const auto & point : leaf->overflow) {
+            if (key.contains(point)) {
+                result.push_back(point);
+            }
+        }
+        return;
+    }
+    for (const Node * child : static_cast<const Internal *>(node)->child) {
+        range_impl(key, child, result);
+    }
+}
+
+std::pair<iterator, iterator> PointSet::make_range(std::vector<Point> && result)
+{
+    if (result.empty()) {
+        return {};
+    }
+    std::sort(result.begin(), result.end());
+    return {iterator(std::make_shared<const std::vector<Point>>(std::move(result))), {}};
+}
+
+std::pair<iterator, iterator> PointSet::range(const Rect & key) const
+{
+    std::vector<Point> result;
+    range_impl(key, root, result);
+    return make_range(std::move(result));
+}
+
+std::optional<Point> PointSet::nearest(const Point & key) const
+{
+    auto [begin, end] = nearest(key, 1);
+    if (begin == end) {
+        return {};
+    }
+    return *begin;
+}
+
+std::pair<iterator, iterator> PointSet::nearest(const Point & key, std::size_t k) const
+{
+    if (k == 0 || root == nullptr) {
+        return {};
+    }
+    using Entry = std::pair<double, const Node *>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> cells;
+    auto farther = [](const std::pair<double, Point> & a, const std::pair<double, Point> & b) { return a.first < b.first; };
+    std::priority_queue<std::pair<double, Point>, std::vector<std::pair<double, Point>>, decltype(farther)> best(farther);
+    auto offer = [&](const Point & point) {
+        double distance = key.distance(point);
+        if (best.size() < k) {
+            best.emplace(distance, point);
+        }
+        else if (distance < best.top().first) {
+            best.pop();
+            best.emplace(distance, point);
+        }
+    };
+    cells.emplace(cell_distance(root->cx, root->cy, root->half, key), root);
+    while (!cells.empty()) {
+        auto [distance, node] = cells.top();
+        cells.pop();
+        if (best.size() == k && distance > best.top().first) {
+            break;
+        }
+        if (node->leaf) {
+            const auto * leaf = static_cast<const Leaf *>(node);
+            for (std::size_t i = 0; i < leaf->count; ++i) {
+                offer({leaf->xs[i], leaf->ys[i]});
+            }
+            for (const auto & point : leaf->overflow) {
+                offer(point);
+            }
+            continue;
+        }
+        for (const Node * child : static_cast<const Internal *>(node)->child) {
+            if (child != nullptr) {
+                cells.emplace(cell_distance(child->cx, child->cy, child->half, key), child);
+            }
+        }
+    }
+    std::vector<Point> result;
+    result.reserve(best.size());
+    for (; !best.empty(); best.pop()) {
+        result.push_back(best.top().second);
+    }
+    return make_range(std::move(result));
+}
+
+iterator::iterator(const Node * root)
+{
+    if (root != nullptr) {
+        stack.push_back(root);
+        descend();
+    }
+}
+
+iterator::iterator(std::shared_ptr<const std::vector<Point>> result)
+    : points(std::move(result))
+{
+    load();
+}
+
+// Moves to the next non-empty leaf on the stack, or to the end.
+void iterator::descend()
+{
+    leaf = nullptr;
+    index = 0;
+    while (!stack.empty()) {
+        const Node * node = stack.back();
+        stack.pop_back();
+        if (node->leaf) {
+            const auto * candidate = static_cast<const Leaf *>(node);
+            if (candidate->size != 0) {
+                leaf = candidate;
+                load();
+                return;
+            }
+            continue;
+        }
+        for (const Node * child : static_cast<const Internal *>(node)->child) {
+            if (child != nullptr) {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+void iterator::load()
+{
+    if (points) {
+        current = (*points)[index];
+    }
+    else if (index < leaf->count) {
+        current = Point(leaf->xs[index], leaf->ys[index]);
+    }
+    else {
+        current = leaf->overflow[index - leaf->count];
+    }
+}
+
+iterator & iterator::operator++()
+{
+    if (points) {
+        if (++index == points->size()) {
+            points = nullptr;
+            index = 0;
+        }
+        else {
+            load();
+        }
+        return *this;
+    }
+    if (leaf == nullptr) {
+        return *this;
+    }
+    if (++index < leaf->size) {
+        load();
+    }
+    else {
+        descend();
+    }
+    return *this;
+}
+
+std::ostream & operator<<(std::ostream & out, const PointSet & set)
+{
+    out << "PointSet {\n";
+    for (const auto & point : set) {
+        out << '\t' << point << ",\n";
+    }
+    out << "}";
+    return out;
+}
+
+} // namespace quadtree
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace quadtree {
+
+/*
+ * Point-region quadtree with bucket leaves and the same interface as
+ * kdtree::PointSet. Cells are squares split at their centre, so the shape
+ * of the tree depends on where points are, not on insertion order. The
+ * root square grows by doubling when a point lands outside it. Nodes come
+ * from per-tree free-list pools.
+ */
+class PointSet
+{
+    static constexpr std::size_t bucket_capacity = 16;
+    static constexpr std::size_t max_depth = 64;
+
+    struct Node
+    {
+        double cx, cy, half; // cell is [cx - half, cx + half) x [cy - half, cy + half)
+        std::size_t size;    // points in the subtree
+        bool leaf;
+    };
+
+    struct Internal : Node
+    {
+        Node * child[4]; // index = (x >= cx) | (y >= cy) << 1; null means empty
+    };
+
+    struct Leaf : Node
+    {
+        std::size_t count;
+        double xs[bucket_capacity];
+        double ys[bucket_capacity];
+        std::vector<Point> overflow; // only used by leaves at max_depth
+    };
+
+    static std::size_t quadrant(const Node & node, const Point & point)
+    {
+        return static_cast<std::size_t>(point.x() >= node.cx) | (static_cast<std::size_t>(point.y() >= node.cy) << 1);
+    }
+
+    static Rect cell(const Node & node)
+    {
+        return {{node.cx - node.half, node.cy - node.half}, {node.cx + node.half, node.cy + node.half}};
+    }
+
+    Leaf * make_leaf(double cx, double cy, double half);
+    Internal * make_internal(double cx, double cy, double half);
+    void destroy(Node * node);
+    void grow_root(const Point &);
+    Internal * split(Leaf * leaf);
+    bool leaf_contains(const Leaf & leaf, const Point & key) const;
+
+    void range_impl(const Rect & key, const Node * node, std::vector<Point> & result) const;
+    static void report(const Node * node, std::vector<Point> & result);
+
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Point;
+        using pointer = const Point *;
+        using reference = const Point &;
+
+        iterator()
+        {
+        }
+
+        reference operator*() const { return current; }
+        pointer operator->() const { return &current; }
+
+        // Prefix increment
+        iterator & operator++();
+
+        // Postfix increment
+        iterator operator++(int)
+        {
+            iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend bool operator==(const iterator & a, const iterator & b)
+        {
+            return a.leaf == b.leaf && a.index == b.index && a.points == b.points;
+        };
+        friend bool operator!=(const iterator & a, const iterator & b)
+        {
+            return !(a == b);
+        };
+
+    private:
+        friend class PointSet;
+
+        explicit iterator(const Node * root);
+        explicit iterator(std::shared_ptr<const std::vector<Point>> points);
+
+        void descend();
+        void load();
+
+        // Tree walk: pending subtrees and the leaf being read.
+        std::vector<const Node *> stack;
+        const Leaf * leaf = nullptr;
+        // Query results owned by the iterator.
+        std::shared_ptr<const std::vector<Point>> points;
+        std::size_t index = 0;
+        Point current = {0, 0};
+    };
+
+    PointSet(const std::string & filename = {});
+    PointSet(PointSet &&) noexcept;
+    PointSet & operator=(PointSet &&) noexcept;
+    ~PointSet();
+
+    bool empty() const;
+    std::size_t size() const;
+    void put(const Point &);
+    bool contains(const Point &) const;
+
+    std::pair<iterator, iterator> range(const Rect &) const;
+
+    iterator begin() const
+    {
+        return iterator(root);
+    }
+    iterator end() const
+    {
+        return {};
+    }
+
+    std::optional<Point> nearest(const Point &) const;
+    std::pair<iterator, iterator> nearest(const Point &, std::size_t) const;
+
+    // Bytes held by the node pools.
+    std::size_t memory_bytes() const;
+
+    friend std::ostream & operator<<(std::ostream &, const PointSet &);
+
+private:
+    static std::pair<iterator, iterator> make_range(std::vector<Point> && points);
+
+    std::unique_ptr<pool::FreeListPool> leaves;
+    std::unique_ptr<pool::FreeListPool> internals;
+    Node * root = nullptr;
+};
+
+} // namespace quadtree
@@ -0,0 +1,198 @@
+#include "rangetree.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace rangetree {
+
+namespace {
+template <class Body>
+void parallel(unsigned threads, std::size_t total, Body && body)
+{
+    if (threads <= 1) {
+        body(0u, std::size_t{0}, total);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, t, threads, total] { body(t, total * t / threads, total * (t + 1) / threads); });
+    }
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+// Sorts equal slices in parallel, then merges neighbouring runs pairwise.
+template <class T, class Compare>
+void parallel_sort(std::vector<T> & v, Compare comp, unsigned threads)
+{
+    std::vector<std::size_t> bounds;
+    for (unsigned t = 0; t <= threads; ++t) {
+        bounds.push_back(v.size() * t / threads);
+    }
+    parallel(threads, threads, [&](unsigned, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::sort(v.begin() + bounds[i], v.begin() + bounds[i + 1], comp);
+        }
+    });
+    while (bounds.size() > 2) {
+        std::vector<std::size_t> merged;
+        const std::size_t pairs = (bounds.size() - 1) / 2;
+        parallel(std::min<std::size_t>(threads, pairs), pairs, [&](unsigned, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                std::inplace_merge(v.begin() + bounds[2 * i], v.begin() + bounds[2 * i + 1], v.begin() + bounds[2 * i + 2], comp);
+            }
+        });
+        for (std::size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != bounds.back()) {
+            merged.push_back(bounds.back());
+        }
+        bounds.swap(merged);
+    }
+}
+} // namespace
+
+Tree::Tree(std::vector<Point> points, unsigned threads)
+    : points_(std::move(points))
+{
+    const std::size_t n = points_.size();
+    if (n >= std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("rangetree::Tree: too many points");
+    }
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(n / 65536 + 1)));
+    parallel_sort(points_, [](const Point & a, const Point & b) {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+    }, threads);
+    while ((std::size_t{1} << height_) < n) {
+        ++height_;
+    }
+
+    std::vector<std::uint32_t> by_y(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        by_y[i] = static_cast<std::uint32_t>(i);
+    }
+    parallel_sort(by_y, [this](std::uint32_t a, std::uint32_t b) {
+        return points_[a].y() < points_[b].y() || (points_[a].y() == points_[b].y() && a < b);
+    }, threads);
+    ys_.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        ys_[i] = points_[by_y[i]].y();
+    }
+    if (height_ == 0) {
+        return;
+    }
+
+    order_.resize(n * height_);
+    left_.resize((n + 1) * height_);
+    std::copy(by_y.begin(), by_y.end(), order_.begin());
+    std::vector<std::uint32_t> chunk_left(threads + 1);
+    for (unsigned level = 0; level < height_; ++level) {
+        const unsigned bit = height_ - level - 1;
+        const std::uint32_t * order = &order_[level * n];
+        std::uint32_t * left = &left_[level * (n + 1)];
+        // Running left counts: per-chunk totals, an exclusive scan, then a fill.
+        parallel(threads, n, [&](unsigned t, std::size_t begin, std::size_t end) {
+            std::uint32_t count = 0;
+            for (std::size_t i = begin; i < end; ++i) {
+                count += ((order[i] >> bit) & 1) == 0;
+            }
+            chunk_left[t + 1] = count;
+        });
+        for (unsigned t = 0; t < threads; ++t) {
+            chunk_left[t + 1] += chunk_left[t];
+        }
+        parallel(threads, n, [&](unsigned t, std::size_t begin, std::size_t end) {
+            std::uint32_t count = chunk_left[t];
+            for (std::size_t i = begin; i < end; ++i) {
+                left[i] = count;
+                count += ((order[i] >> bit) & 1) == 0;
+            }
+        });
+        left[n] = chunk_left[threads];
+        if (level + 1 == height_) {
+            break;
+        }
+        // Stable partition of every node into its children on the next level.
+        std::uint32_t * next = &order_[(level + 1) * n];
+        parallel(threads, n, [&](unsigned, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                const std::size_t node = (i >> (bit + 1)) << (bit + 1);
+                const std::size_t to_left = left[i] - left[node];
+                if (((order[i] >> bit) & 1) == 0) {
+                    next[node + to_left] = order[i];
+                }
+                else {
+                    next[node + (std::size_t{1} << bit) + (i - node - to_left)] = order[i];
+                }
+            }
+        });
+    }
+}
+
+template <class F>
+void Tree::descend(unsigned level, std::size_t begin, std::size_t lo, std::size_t hi, std::size_t from, std::size_t to, F & report) const
+{
+    const std::size_t n = points_.size();
+    const std::size_t end = std::min(n, begin + (std::size_t{1} << (height_ - level)));
+    if (from >= to || end <= lo || begin >= hi) {
+        return;
+    }
+    if (lo <= begin && end <= hi) {
+        report(level, from, to);
+        return;
+    }
+    const std::uint32_t * left = &left_[level * (n + 1)];
+    const std::size_t mid = begin + (std::size_t{1} << (height_ - level - 1));
+    const std::size_t left_from = left[from] - left[begin];
+    const std::size_t left_to = left[to] - left[begin];
+    descend(level + 1, begin, lo, hi, begin + left_from, begin + left_to, report);
+    descend(level + 1, mid, lo, hi, mid + (from - begin) - left_from, mid + (to - begin) - left_to, report);
+}
+
+template <class F>
+void Tree::query(const Rect & rect, F && report) const
+{
+    auto by_x = [](const Point & p, double x) { return p.x() < x; };
+    auto x_below = [](double x, const Point & p) { return x < p.x(); };
+    const std::size_t lo = std::lower_bound(points_.begin(), points_.end(), rect.xmin(), by_x) - points_.begin();
+    const std::size_t hi = std::upper_bound(points_.begin(), points_.end(), rect.xmax(), x_below) - points_.begin();
+    const std::size_t from = std::lower_bound(ys_.begin(), ys_.end(), rect.ymin()) - ys_.begin();
+    const std::size_t to = std::upper_bound(ys_.begin(), ys_.end(), rect.ymax()) - ys_.begin();
+    if (lo < hi && from < to) {
+        descend(0, 0, lo, hi, from, to, report);
+    }
+}
+
+std::vector<Point> Tree::range(const Rect & rect) const
+{
+    std::vector<Point> result;
+    query(rect, [&](unsigned level, std::size_t from, std::size_t to) {
+        if (level == height_) {
+            result.insert(result.end(), points_.begin() + from, points_.begin() + to);
+            return;
+        }
+        const std::uint32_t * order = &order_[level * points_.size()];
+        for (std::size_t i = from; i < to; ++i) {
+            result.push_back(points_[order[i]]);
+        }
+    });
+    return result;
+}
+
+std::size_t Tree::count(const Rect & rect) const
+{
+    std::size_t result = 0;
+    query(rect, [&](unsigned, std::size_t from, std::size_t to) { result += to - from; });
+    return result;
+}
+
+std::size_t Tree::memory_bytes() const
+{
+    return points_.capacity() * sizeof(Point) + ys_.capacity() * sizeof(double) +
+            (order_.capacity() + left_.capacity()) * sizeof(std::uint32_t);
+}
+
+} // namespace rangetree
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace rangetree {
+
+/*
+ * Static 2D range tree with fractional cascading.
+ *
+ * Points are ranked by x; level l of the tree splits the ranks on bit
+ * (height - l - 1), so every node is an aligned block of ranks. Each level
+ * stores the ranks of its nodes' points in y order together with a running
+ * count of points sent to the left child, which lets a query carry its y
+ * bounds from a node to both children in O(1) after a single binary search
+ * at the root. Reporting is O(log n + k) and counting O(log n), at the cost
+ * of 8 bytes per point per level.
+ */
+class Tree
+{
+public:
+    Tree() = default;
+    Tree(std::vector<Point> points, unsigned threads = std::thread::hardware_concurrency());
+
+    std::size_t size() const
+    {
+        return points_.size();
+    }
+    bool empty() const
+    {
+        return points_.empty();
+    }
+
+    // Points inside the rect (boundary included), in no particular order.
+    std::vector<Point> range(const Rect &) const;
+    std::size_t count(const Rect &) const;
+
+    // Points ordered by x, then y.
+    const Point * begin() const
+    {
+        return points_.data();
+    }
+    const Point * end() const
+    {
+        return points_.data() + points_.size();
+    }
+
+    std::size_t memory_bytes() const;
+
+private:
+    template <class F>
+    void query(const Rect &, F && report) const;
+    template <class F>
+    void descend(unsigned level, std::size_t node, std::size_t lo, std::size_t hi, std::size_t from, std::size_t to, F & report) const;
+
+    std::vector<Point> points_;
+    std::vector<double> ys_;
+    unsigned height_ = 0;
+    // order_[l * n + i]: rank at position i of level l.
+    std::vector<std::uint32_t> order_;
+    // left_[l * (n + 1) + i]: points at positions [0, i) of level l that go left.
+    std::vector<std::uint32_t> left_;
+};
+
+} // namespace rangetree
@@ -0,0 +1,110 @@
+#include "rectbatch.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rectbatch {
+
+namespace {
+#if defined(__AVX__)
+constexpr std::size_t lanes = 4;
+using vec = __m256d;
+vec broadcast(double x) { return _mm256_set1_pd(x); }
+vec load(const double * p) { return _mm256_loadu_pd(p); }
+void store(double * p, vec v) { _mm256_storeu_pd(p, v); }
+vec both(vec a, vec b) { return _mm256_and_pd(a, b); }
+vec less_equal(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+vec sub(vec a, vec b) { return _mm256_sub_pd(a, b); }
+vec max(vec a, vec b) { return _mm256_max_pd(a, b); }
+vec root(vec a, vec b) { return _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b))); }
+unsigned mask(vec v) { return static_cast<unsigned>(_mm256_movemask_pd(v)); }
+#elif defined(__SSE2__)
+constexpr std::size_t lanes = 2;
+using vec = __m128d;
+vec broadcast(double x) { return _mm_set1_pd(x); }
+vec load(const double * p) { return _mm_loadu_pd(p); }
+void store(double * p, vec v) { _mm_storeu_pd(p, v); }
+vec both(vec a, vec b) { return _mm_and_pd(a, b); }
+vec less_equal(vec a, vec b) { return _mm_cmple_pd(a, b); }
+vec sub(vec a, vec b) { return _mm_sub_pd(a, b); }
+vec max(vec a, vec b) { return _mm_max_pd(a, b); }
+vec root(vec a, vec b) { return _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(a, a), _mm_mul_pd(b, b))); }
+unsigned mask(vec v) { return static_cast<unsigned>(_mm_movemask_pd(v)); }
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__)
+// Appends the set bits of a lane mask as indices, without branching on them.
+std::size_t emit(unsigned bits, std::size_t base, std::uint32_t * hits, std::size_t count)
+{
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        hits[count] = static_cast<std::uint32_t>(base + lane);
+        count += (bits >> lane) & 1;
+    }
+    return count;
+}
+#endif
+} // namespace
+
+std::size_t contains(const Rect & rect, const Points & points, std::uint32_t * hits)
+{
+    std::size_t i = 0, count = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    const vec x0 = broadcast(rect.xmin()), x1 = broadcast(rect.xmax());
+    const vec y0 = broadcast(rect.ymin()), y1 = broadcast(rect.ymax());
+    for (; i + lanes <= points.size; i += lanes) {
+        const vec x = load(points.xs + i), y = load(points.ys + i);
+        const vec in = both(both(less_equal(x0, x), less_equal(x, x1)), both(less_equal(y0, y), less_equal(y, y1)));
+        count = emit(mask(in), i, hits, count);
+    }
+#endif
+    for (; i < points.size; ++i) {
+        hits[count] = static_cast<std::uint32_t>(i);
+        count += rect.contains({points.xs[i], points.ys[i]});
+    }
+    return count;
+}
+
+std::size_t intersects(const Rect & rect, const Rects & rects, std::uint32_t * hits)
+{
+    std::size_t i = 0, count = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    const vec x0 = broadcast(rect.xmin()), x1 = broadcast(rect.xmax());
+    const vec y0 = broadcast(rect.ymin()), y1 = broadcast(rect.ymax());
+    for (; i + lanes <= rects.size; i += lanes) {
+        const vec overlap_x = both(less_equal(load(rects.xmin + i), x1), less_equal(x0, load(rects.xmax + i)));
+        const vec overlap_y = both(less_equal(load(rects.ymin + i), y1), less_equal(y0, load(rects.ymax + i)));
+        count = emit(mask(both(overlap_x, overlap_y)), i, hits, count);
+    }
+#endif
+    for (; i < rects.size; ++i) {
+        hits[count] = static_cast<std::uint32_t>(i);
+        count += rect.intersects({{rects.xmin[i], rects.ymin[i]}, {rects.xmax[i], rects.ymax[i]}});
+    }
+    return count;
+}
+
+void distance(const Rect & rect, const Points & points, double * out)
+{
+    std::size_t i = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    const vec x0 = broadcast(rect.xmin()), x1 = broadcast(rect.xmax());
+    const vec y0 = broadcast(rect.ymin()), y1 = broadcast(rect.ymax());
+    const vec zero = broadcast(0);
+    for (; i + lanes <= points.size; i += lanes) {
+        const vec x = load(points.xs + i), y = load(points.ys + i);
+        const vec dx = max(max(sub(x0, x), sub(x, x1)), zero);
+        const vec dy = max(max(sub(y0, y), sub(y, y1)), zero);
+        store(out + i, root(dx, dy));
+    }
+#endif
+    for (; i < points.size; ++i) {
+        double dx = std::max({rect.xmin() - points.xs[i], 0.0, points.xs[i] - rect.xmax()});
+        double dy = std::max({rect.ymin() - points.ys[i], 0.0, points.ys[i] - rect.ymax()});
+        out[i] = std::sqrt(dx * dx + dy * dy);
+    }
+}
+
+} // namespace rectbatch
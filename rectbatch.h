@@ -0,0 +1,39 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rectbatch {
+
+/*
+ * One query rect against many points or rects stored as separate
+ * coordinate arrays (structure of arrays). The kernels use AVX when the
+ * build enables it, SSE2 otherwise, and a scalar loop for the tail; the
+ * results match Rect::contains / Rect::intersects exactly. Hit kernels
+ * write the indices of matching elements to `hits`, which needs room for
+ * one index per element, and return how many there are.
+ */
+struct Points
+{
+    const double * xs;
+    const double * ys;
+    std::size_t size;
+};
+
+struct Rects
+{
+    const double * xmin;
+    const double * ymin;
+    const double * xmax;
+    const double * ymax;
+    std::size_t size;
+};
+
+std::size_t contains(const Rect & rect, const Points & points, std::uint32_t * hits);
+std::size_t intersects(const Rect & rect, const Rects & rects, std::uint32_t * hits);
+// out[i] = rect.distance(point i), computed as sqrt(dx * dx + dy * dy).
+void distance(const Rect & rect, const Points & points, double * out);
+
+} // namespace rectbatch
@@ -0,0 +1,479 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+namespace rtree {
+
+/*
+ * R-tree over rectangles with a payload per entry. A bulk load packs the
+ * entries with Sort-Tile-Recursive; insert() follows the R* rules (overlap-
+ * aware subtree choice, forced reinsertion once per level, margin/overlap
+ * split). Node boxes are kept as four coordinate arrays so that each array
+ * fills one cache line and the overlap test over a node is a straight loop.
+ */
+template <class T>
+class RTree
+{
+public:
+    static constexpr std::size_t max_entries = 64 / sizeof(double);
+    static constexpr std::size_t min_entries = max_entries * 2 / 5;
+
+    struct Entry
+    {
+        Rect rect;
+        T value;
+    };
+
+    RTree() = default;
+
+    explicit RTree(std::vector<Entry> entries)
+    {
+        std::vector<Box> level;
+        level.reserve(entries.size());
+        values_.reserve(entries.size());
+        for (auto & entry : entries) {
+            level.push_back({entry.rect.xmin(), entry.rect.ymin(), entry.rect.xmax(), entry.rect.ymax(), static_cast<std::uint32_t>(values_.size())});
+            values_.push_back(std::move(entry.value));
+        }
+        size_ = level.size();
+        if (level.empty()) {
+            return;
+        }
+        for (std::uint32_t height = 0;; ++height) {
+            level = pack(level, height);
+            if (level.size() == 1) {
+                root_ = level.front().slot;
+                break;
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    // Levels above the entries; 0 for an empty tree.
+    std::size_t height() const
+    {
+        return nodes_.empty() ? 0 : nodes_[root_].level + 1;
+    }
+    Rect bounds() const
+    {
+        return nodes_.empty() ? Rect() : to_rect(bounds(nodes_[root_]));
+    }
+
+    void insert(const Rect & rect, T value)
+    {
+        Box box{rect.xmin(), rect.ymin(), rect.xmax(), rect.ymax(), static_cast<std::uint32_t>(values_.size())};
+        values_.push_back(std::move(value));
+        if (nodes_.empty()) {
+            root_ = make_node(0);
+        }
+        std::vector<bool> reinserted(height(), false);
+        insert_box(box, 0, reinserted);
+        ++size_;
+    }
+
+    // Calls f(rect, value) for entries overlapping the window (touching counts).
+    template <class F>
+    void for_each_intersecting(const Rect & window, F && f) const
+    {
+        const Box w = to_box(window);
+        search([&](const Box & b) { return overlaps(b, w); }, [&](const Box & b) { return overlaps(b, w); }, f);
+    }
+
+    // Calls f(rect, value) for entries lying entirely inside the window.
+    template <class F>
+    void for_each_within(const Rect & window, F && f) const
+    {
+        const Box w = to_box(window);
+        search([&](const Box & b) { return overlaps(b, w); }, [&](const Box & b) { return encloses(w, b); }, f);
+    }
+
+    // Calls f(rect, value) for entries that cover the point.
+    template <class F>
+    void for_each_containing(const Point & point, F && f) const
+    {
+        const Box w{point.x(), point.y(), point.x(), point.y(), 0};
+        search([&](const Box & b) { return overlaps(b, w); }, [&](const Box & b) { return overlaps(b, w); }, f);
+    }
+
+    std::vector<Entry> intersecting(const Rect & window) const
+    {
+        std::vector<Entry> result;
+        for_each_intersecting(window, [&](const Rect & rect, const T & value) { result.push_back({rect, value}); });
+        return result;
+    }
+
+    std::vector<Entry> within(const Rect & window) const
+    {
+        std::vector<Entry> result;
+        for_each_within(window, [&](const Rect & rect, const T & value) { result.push_back({rect, value}); });
+        return result;
+    }
+
+    std::vector<Entry> containing(const Point & point) const
+    {
+        std::vector<Entry> result;
+        for_each_containing(point, [&](const Rect & rect, const T & value) { result.push_back({rect, value}); });
+        return result;
+    }
+
+    // The k entries closest to the point (distance 0 inside), closest first.
+    std::vector<Entry> nearest(const Point & point, std::size_t k) const
+    {
+        std::vector<Entry> result;
+        if (nodes_.empty() || k == 0) {
+            return result;
+        }
+        struct Item
+        {
+            double distance;
+            std::uint32_t slot;
+            bool entry;
+            std::uint32_t node;
+            std::uint32_t index;
+            bool operator<(const Item & another) const
+            {
+                return distance > another.distance;
+            }
+        };
+        std::priority_queue<Item> queue;
+        queue.push({0, root_, false, 0, 0});
+        while (!queue.empty() && result.size() < k) {
+            Item item = queue.top();
+            queue.pop();
+            if (item.entry) {
+                const Node & leaf = nodes_[item.node];
+                result.push_back({to_rect(box(leaf, item.index)), values_[item.slot]});
+                continue;
+            }
+            const Node & node = nodes_[item.slot];
+            for (std::uint32_t i = 0; i < node.count; ++i) {
+                queue.push({distance(box(node, i), point), node.slot[i], node.level == 0, item.slot, i});
+            }
+        }
+        return result;
+    }
+
+    std::size_t memory_bytes() const
+    {
+        return nodes_.size() * sizeof(Node) + values_.capacity() * sizeof(T);
+    }
+
+private:
+    struct Box
+    {
+        double xmin, ymin, xmax, ymax;
+        std::uint32_t slot; // value index in leaves, node index above
+    };
+
+    struct alignas(64) Node
+    {
+        double xmin[max_entries];
+        double ymin[max_entries];
+        double xmax[max_entries];
+        double ymax[max_entries];
+        std::uint32_t slot[max_entries];
+        std::uint32_t count;
+        std::uint32_t level; // 0 for leaves
+    };
+
+    static Box to_box(const Rect & rect)
+    {
+        return {rect.xmin(), rect.ymin(), rect.xmax(), rect.ymax(), 0};
+    }
+    static Rect to_rect(const Box & box)
+    {
+        return {{box.xmin, box.ymin}, {box.xmax, box.ymax}};
+    }
+    static Box box(const Node & node, std::size_t i)
+    {
+        return {node.xmin[i], node.ymin[i], node.xmax[i], node.ymax[i], node.slot[i]};
+    }
+    static bool overlaps(const Box & a, const Box & b)
+    {
+        return a.xmin <= b.xmax && b.xmin <= a.xmax && a.ymin <= b.ymax && b.ymin <= a.ymax;
+    }
+    static bool encloses(const Box & outer, const Box & inner)
+    {
+        return outer.xmin <= inner.xmin && inner.xmax <= outer.xmax && outer.ymin <= inner.ymin && inner.ymax <= outer.ymax;
+    }
+    static double area(const Box & b)
+    {
+        return (b.xmax - b.xmin) * (b.ymax - b.ymin);
+    }
+    static double margin(const Box & b)
+    {
+        return (b.xmax - b.xmin) + (b.ymax - b.ymin);
+    }
+    static Box join(const Box & a, const Box & b)
+    {
+        return {std::min(a.xmin, b.xmin), std::min(a.ymin, b.ymin), std::max(a.xmax, b.xmax), std::max(a.ymax, b.ymax), a.slot};
+    }
+    static double overlap(const Box & a, const Box & b)
+    {
+        double w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+        double h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+        return w > 0 && h > 0 ? w * h : 0;
+    }
+    static double distance(const Box & b, const Point & p)
+    {
+        double dx = std::max({b.xmin - p.x(), 0.0, p.x() - b.xmax});
+        double dy = std::max({b.ymin - p.y(), 0.0, p.y() - b.ymax});
+        return std::hypot(dx, dy);
+    }
+    static Box bounds(const Node & node)
+    {
+        Box result = box(node, 0);
+        for (std::uint32_t i = 1; i < node.count; ++i) {
+            result = join(result, box(node, i));
+        }
+        return result;
+    }
+    template <class It>
+    static Box bounds(It begin, It end)
+    {
+        Box result = *begin;
+        for (++begin; begin != end; ++begin) {
+            result = join(result, *begin);
+        }
+        return result;
+    }
+
+    std::uint32_t make_node(std::uint32_t level)
+    {
+        nodes_.emplace_back();
+        nodes_.back().count = 0;
+        nodes_.back().level = level;
+        return static_cast<std::uint32_t>(nodes_.size() - 1);
+    }
+
+    void set(Node & node, std::size_t i, const Box & b)
+    {
+        node.xmin[i] = b.xmin;
+        node.ymin[i] = b.ymin;
+        node.xmax[i] = b.xmax;
+        node.ymax[i] = b.ymax;
+        node.slot[i] = b.slot;
+    }
+
+    void assign(Node & node, const Box * begin, const Box * end)
+    {
+        node.count = 0;
+        for (; begin != end; ++begin) {
+            set(node, node.count++, *begin);
+        }
+    }
+
+    // Sort-Tile-Recursive: slice by x centre, then cut each slice by y centre.
+    std::vector<Box> pack(std::vector<Box> & boxes, std::uint32_t level)
+    {
+        auto cx = [](const Box & a, const Box & b) { return a.xmin + a.xmax < b.xmin + b.xmax; };
+        auto cy = [](const Box & a, const Box & b) { return a.ymin + a.ymax < b.ymin + b.ymax; };
+        const std::size_t nodes = (boxes.size() + max_entries - 1) / max_entries;
+        const std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(nodes))));
+        const std::size_t slice_size = slices * max_entries;
+        std::sort(boxes.begin(), boxes.end(), cx);
+        std::vector<Box> parents;
+        for (std::size_t s = 0; s < boxes.size(); s += slice_size) {
+            auto slice_end = boxes.begin() + std::min(boxes.size(), s + slice_size);
+            std::sort(boxes.begin() + s, slice_end, cy);
+            for (auto it = boxes.begin() + s; it < slice_end; it += std::min<std::ptrdiff_t>(max_entries, slice_end - it)) {
+                auto end = it + std::min<std::ptrdiff_t>(max_entries, slice_end - it);
+                std::uint32_t node = make_node(level);
+                assign(nodes_[node], &*it, &*it + (end - it));
+                Box parent = bounds(it, end);
+                parent.slot = node;
+                parents.push_back(parent);
+            }
+        }
+        return parents;
+    }
+
+    template <class Descend, class Accept, class F>
+    void search(Descend && descend, Accept && accept, F & f) const
+    {
+        if (nodes_.empty()) {
+            return;
+        }
+        std::vector<std::uint32_t> stack{root_};
+        while (!stack.empty()) {
+            const Node & node = nodes_[stack.back()];
+            stack.pop_back();
+            for (std::uint32_t i = 0; i < node.count; ++i) {
+                const Box b = box(node, i);
+                if (node.level == 0) {
+                    if (accept(b)) {
+                        f(to_rect(b), values_[b.slot]);
+                    }
+                }
+                else if (descend(b)) {
+                    stack.push_back(b.slot);
+                }
+            }
+        }
+    }
+
+    // R*: least overlap enlargement just above the leaves, least area
+    // enlargement higher up; ties go to the smaller box.
+    std::uint32_t choose_subtree(const Node & node, const Box & b) const
+    {
+        std::uint32_t best = 0;
+        double best_overlap = INF, best_growth = INF, best_area = INF;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            const Box child = box(node, i);
+            const Box grown = join(child, b);
+            double growth = area(grown) - area(child);
+            double overlap_growth = 0;
+            if (node.level == 1) {
+                for (std::uint32_t j = 0; j < node.count; ++j) {
+                    if (j != i) {
+                        overlap_growth += overlap(grown, box(node, j)) - overlap(child, box(node, j));
+                    }
+                }
+            }
+            if (std::make_tuple(overlap_growth, growth, area(child)) < std::make_tuple(best_overlap, best_growth, best_area)) {
+                best = i;
+                best_overlap = overlap_growth;
+                best_growth = growth;
+                best_area = area(child);
+            }
+        }
+        return best;
+    }
+
+    void insert_box(const Box & b, std::uint32_t level, std::vector<bool> & reinserted)
+    {
+        std::vector<std::pair<Box, std::uint32_t>> pending;
+        std::uint32_t sibling = insert_into(root_, b, level, reinserted, pending);
+        if (sibling != none) {
+            std::uint32_t old_root = root_;
+            root_ = make_node(nodes_[old_root].level + 1);
+            Box left = bounds(nodes_[old_root]), right = bounds(nodes_[sibling]);
+            left.slot = old_root;
+            right.slot = sibling;
+            set(nodes_[root_], 0, left);
+            set(nodes_[root_], 1, right);
+            nodes_[root_].count = 2;
+            reinserted.push_back(false);
+        }
+        for (const auto & [box, box_level] : pending) {
+            insert_box(box, box_level, reinserted);
+        }
+    }
+
+    // Returns the index of the new sibling if the node had to split.
+    std::uint32_t insert_into(std::uint32_t id, const Box & b, std::uint32_t level, std::vector<bool> & reinserted, std::vector<std::pair<Box, std::uint32_t>> & pending)
+    {
+        Node & node = nodes_[id];
+        Box extra = b;
+        if (node.level != level) {
+            std::uint32_t i = choose_subtree(node, b);
+            std::uint32_t sibling = insert_into(node.slot[i], b, level, reinserted, pending);
+            Box child = bounds(nodes_[node.slot[i]]);
+            child.slot = node.slot[i];
+            set(node, i, child);
+            if (sibling == none) {
+                return none;
+            }
+            extra = bounds(nodes_[sibling]);
+            extra.slot = sibling;
+        }
+        if (node.count < max_entries) {
+            set(node, node.count++, extra);
+            return none;
+        }
+        return overflow(id, extra, reinserted, pending);
+    }
+
+    std::uint32_t overflow(std::uint32_t id, const Box & extra, std::vector<bool> & reinserted, std::vector<std::pair<Box, std::uint32_t>> & pending)
+    {
+        Node & node = nodes_[id];
+        std::vector<Box> boxes;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            boxes.push_back(box(node, i));
+        }
+        boxes.push_back(extra);
+
+        if (id != root_ && !reinserted[node.level]) {
+            // Forced reinsertion: push out the entries farthest from the centre.
+            reinserted[node.level] = true;
+            const Box all = bounds(boxes.begin(), boxes.end());
+            const double cx = all.xmin + all.xmax, cy = all.ymin + all.ymax;
+            auto far = [cx, cy](const Box & b) {
+                return std::hypot(b.xmin + b.xmax - cx, b.ymin + b.ymax - cy);
+            };
+            std::sort(boxes.begin(), boxes.end(), [&](const Box & a, const Box & b) { return far(a) > far(b); });
+            const std::size_t evicted = std::max<std::size_t>(1, max_entries * 3 / 10);
+            for (std::size_t i = 0; i < evicted; ++i) {
+                pending.emplace_back(boxes[i], node.level);
+            }
+            assign(node, boxes.data() + evicted, boxes.data() + boxes.size());
+            return none;
+        }
+
+        // Split: the axis with the least total margin, then the cut with the
+        // least overlap (ties by area).
+        const std::size_t total = boxes.size();
+        double best_margin = INF;
+        std::vector<Box> best_order;
+        for (int axis = 0; axis < 2; ++axis) {
+            for (int edge = 0; edge < 2; ++edge) {
+                std::vector<Box> order = boxes;
+                std::sort(order.begin(), order.end(), [axis, edge](const Box & a, const Box & b) {
+                    if (axis == 0) {
+                        return edge == 0 ? a.xmin < b.xmin : a.xmax < b.xmax;
+                    }
+                    return edge == 0 ? a.ymin < b.ymin : a.ymax < b.ymax;
+                });
+                double margins = 0;
+                for (std::size_t k = min_entries; k + min_entries <= total; ++k) {
+                    margins += margin(bounds(order.begin(), order.begin() + k)) + margin(bounds(order.begin() + k, order.end()));
+                }
+                if (margins < best_margin) {
+                    best_margin = margins;
+                    best_order = std::move(order);
+                }
+            }
+        }
+        std::size_t cut = min_entries;
+        double best_overlap = INF, best_area = INF;
+        for (std::size_t k = min_entries; k + min_entries <= total; ++k) {
+            Box left = bounds(best_order.begin(), best_order.begin() + k);
+            Box right = bounds(best_order.begin() + k, best_order.end());
+            double o = overlap(left, right), a = area(left) + area(right);
+            if (o < best_overlap || (o == best_overlap && a < best_area)) {
+                cut = k;
+                best_overlap = o;
+                best_area = a;
+            }
+        }
+        std::uint32_t sibling = make_node(node.level);
+        assign(nodes_[id], best_order.data(), best_order.data() + cut);
+        assign(nodes_[sibling], best_order.data() + cut, best_order.data() + total);
+        return sibling;
+    }
+
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    std::deque<Node> nodes_; // deque: references stay valid while nodes are added
+    std::vector<T> values_;
+    std::uint32_t root_ = 0;
+    std::size_t size_ = 0;
+};
+
+} // namespace rtree
@@ -0,0 +1,416 @@
+#include "sfcindex.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SFC_HAVE_MMAP 1
+#endif
+
+namespace sfc {
+
+namespace {
+constexpr char magic[8] = {'S', 'F', 'C', 'I', 'D', 'X', '0', '1'};
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t curve;
+    std::uint32_t reserved;
+    std::uint64_t size;
+    double xmin, ymin, xmax, ymax;
+    double scale_x, scale_y;
+};
+static_assert(sizeof(Header) % alignof(Point) == 0, "arrays after the header must stay aligned");
+
+struct Owned
+{
+    std::vector<std::uint64_t> keys;
+    std::vector<Point> points;
+};
+
+template <class Body>
+void parallel(unsigned threads, std::size_t total, Body && body)
+{
+    if (threads <= 1) {
+        body(0u, std::size_t{0}, total);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, t, threads, total] { body(t, total * t / threads, total * (t + 1) / threads); });
+    }
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+// Parallel LSD radix sort of (key, index) pairs, one byte per pass. Passes
+// where every key has the same byte are skipped.
+void radix_sort(std::vector<std::uint64_t> & keys, std::vector<std::uint32_t> & index, unsigned threads)
+{
+    const std::size_t n = keys.size();
+    std::vector<std::uint64_t> keys_tmp(n);
+    std::vector<std::uint32_t> index_tmp(n);
+    std::vector<std::array<std::size_t, 256>> counts(threads);
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        parallel(threads, n, [&](unsigned t, std::size_t begin, std::size_t end) {
+            counts[t].fill(0);
+            for (std::size_t i = begin; i < end; ++i) {
+                ++counts[t][(keys[i] >> shift) & 0xFF];
+            }
+        });
+        std::size_t offset = 0;
+        bool trivial = false;
+        for (std::size_t digit = 0; digit < 256; ++digit) {
+            std::size_t total = 0;
+            for (unsigned t = 0; t < threads; ++t) {
+                std::size_t count = counts[t][digit];
+                counts[t][digit] = offset + total;
+                total += count;
+            }
+            trivial |= (total == n);
+            offset += total;
+        }
+        if (trivial) {
+            continue;
+        }
+        parallel(threads, n, [&](unsigned t, std::size_t begin, std::size_t end) {
+            auto & position = counts[t];
+            for (std::size_t i = begin; i < end; ++i) {
+                std::size_t to = position[(keys[i] >> shift) & 0xFF]++;
+                keys_tmp[to] = keys[i];
+                index_tmp[to] = index[i];
+            }
+        });
+        keys.swap(keys_tmp);
+        index.swap(index_tmp);
+    }
+}
+
+#ifndef __BMI2__
+std::uint64_t spread(std::uint32_t v)
+{
+    std::uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+#endif
+} // namespace
+
+std::uint64_t Index::morton(std::uint32_t x, std::uint32_t y)
+{
+#ifdef __BMI2__
+    return _pdep_u64(x, 0x5555555555555555ull) | _pdep_u64(y, 0xAAAAAAAAAAAAAAAAull);
+#else
+    return spread(x) | (spread(y) << 1);
+#endif
+}
+
+std::uint64_t Index::hilbert(std::uint32_t x, std::uint32_t y)
+{
+    std::uint64_t d = 0;
+    for (std::uint32_t s = 1u << 31; s > 0; s >>= 1) {
+        std::uint32_t rx = (x & s) ? 1 : 0;
+        std::uint32_t ry = (y & s) ? 1 : 0;
+        d += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = ~x;
+                y = ~y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+Index::Index(const std::vector<Point> & points, Curve curve, unsigned threads)
+    : curve_(curve)
+    , size_(points.size())
+{
+    if (points.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("sfc::Index: too many points");
+    }
+    double xmin = INF, ymin = INF, xmax = -INF, ymax = -INF;
+    for (const auto & p : points) {
+        xmin = std::min(xmin, p.x());
+        ymin = std::min(ymin, p.y());
+        xmax = std::max(xmax, p.x());
+        ymax = std::max(ymax, p.y());
+    }
+    if (!points.empty()) {
+        bounds_ = Rect({xmin, ymin}, {xmax, ymax});
+        scale_x_ = xmax > xmin ? 4294967295.0 / (xmax - xmin) : 0;
+        scale_y_ = ymax > ymin ? 4294967295.0 / (ymax - ymin) : 0;
+    }
+
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(points.size() / 65536 + 1)));
+    std::vector<std::uint64_t> keys(points.size());
+    std::vector<std::uint32_t> index(points.size());
+    parallel(threads, points.size(), [&](unsigned, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            keys[i] = key(quantize_x(points[i].x()), quantize_y(points[i].y()));
+            index[i] = static_cast<std::uint32_t>(i);
+        }
+    });
+    radix_sort(keys, index, threads);
+
+    auto owned = std::make_shared<Owned>();
+    owned->keys = std::move(keys);
+    owned->points.reserve(points.size());
+    for (std::uint32_t i : index) {
+        owned->points.push_back(points[i]);
+    }
+    keys_ = owned->keys.data();
+    points_ = owned->points.data();
+    storage_ = std::move(owned);
+}
+
+std::uint32_t Index::quantize_x(double x) const
+{
+    double q = (x - bounds_.xmin()) * scale_x_;
+    return q <= 0 ? 0 : q >= 4294967295.0 ? 0xFFFFFFFFu : static_cast<std::uint32_t>(q);
+}
+
+std::uint32_t Index::quantize_y(double y) const
+{
+    double q = (y - bounds_.ymin()) * scale_y_;
+    return q <= 0 ? 0 : q >= 4294967295.0 ? 0xFFFFFFFFu : static_cast<std::uint32_t>(q);
+}
+
+std::uint64_t Index::key(std::uint32_t qx, std::uint32_t qy) const
+{
+    return curve_ == Curve::Morton ? morton(qx, qy) : hilbert(qx, qy);
+}
+
+// Covers the quantized query window with curve intervals of aligned
+// quadtree cells: whole cells inside the window, and partially covered
+// cells once they are a few levels finer than the window itself.
+void Index::intervals(const Rect & rect, std::vector<Interval> & result) const
+{
+    result.clear();
+    const std::uint64_t x0 = quantize_x(rect.xmin()), x1 = quantize_x(rect.xmax());
+    const std::uint64_t y0 = quantize_y(rect.ymin()), y1 = quantize_y(rect.ymax());
+    unsigned window_level = 0;
+    for (std::uint64_t extent = std::max(x1 - x0, y1 - y0); extent != 0; extent >>= 1) {
+        ++window_level;
+    }
+    const unsigned stop = window_level > 4 ? window_level - 4 : 0;
+
+    auto visit = [&](auto && self, std::uint64_t cx, std::uint64_t cy, unsigned level) -> void {
+        const std::uint64_t side = std::uint64_t{1} << level;
+        if (cx > x1 || cx + side - 1 < x0 || cy > y1 || cy + side - 1 < y0) {
+            return;
+        }
+        const bool inside = cx >= x0 && cx + side - 1 <= x1 && cy >= y0 && cy + side - 1 <= y1;
+        if (inside || level <= stop) {
+            if (level == 32) {
+                result.push_back({0, ~std::uint64_t{0}});
+                return;
+            }
+            const std::uint64_t span = std::uint64_t{1} << (2 * level);
+            const std::uint64_t lo = key(static_cast<std::uint32_t>(cx), static_cast<std::uint32_t>(cy)) & ~(span - 1);
+            result.push_back({lo, lo + (span - 1)});
+            return;
+        }
+        const std::uint64_t half = side / 2;
+        self(self, cx, cy, level - 1);
+        self(self, cx + half, cy, level - 1);
+        self(self, cx, cy + half, level - 1);
+        self(self, cx + half, cy + half, level - 1);
+    };
+    visit(visit, 0, 0, 32);
+
+    std::sort(result.begin(), result.end(), [](const Interval & a, const Interval & b) { return a.lo < b.lo; });
+    std::size_t merged = 0;
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        if (merged != 0 && result[merged - 1].hi != ~std::uint64_t{0} && result[merged - 1].hi + 1 >= result[i].lo) {
+            result[merged - 1].hi = std::max(result[merged - 1].hi, result[i].hi);
+        }
+        else {
+            result[merged++] = result[i];
+        }
+    }
+    result.resize(merged);
+}
+
+template <class F>
+void Index::scan(const Rect & rect, F && f) const
+{
+    if (size_ == 0 || rect.xmax() < bounds_.xmin() || rect.xmin() > bounds_.xmax() ||
+        rect.ymax() < bounds_.ymin() || rect.ymin() > bounds_.ymax()) {
+        return;
+    }
+    thread_local std::vector<Interval> ranges;
+    intervals(rect, ranges);
+    const std::uint64_t * end = keys_ + size_;
+    const std::uint64_t * it = keys_;
+    for (const Interval & interval : ranges) {
+        it = std::lower_bound(it, end, interval.lo);
+        for (; it != end && *it <= interval.hi; ++it) {
+            const Point & point = points_[it - keys_];
+            if (rect.contains(point)) {
+                f(point);
+            }
+        }
+    }
+}
+
+bool Index::contains(const Point & point) const
+{
+    if (size_ == 0 || !bounds_.contains(point)) {
+        return false;
+    }
+    std::uint64_t k = key(quantize_x(point.x()), quantize_y(point.y()));
+    for (const std::uint64_t * it = std::lower_bound(keys_, keys_ + size_, k); it != keys_ + size_ && *it == k; ++it) {
+        if (points_[it - keys_] == point) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Point> Index::range(const Rect & rect) const
+{
+    std::vector<Point> result;
+    scan(rect, [&](const Point & point) { result.push_back(point); });
+    return result;
+}
+
+std::size_t Index::count(const Rect & rect) const
+{
+    std::size_t result = 0;
+    scan(rect, [&](const Point &) { ++result; });
+    return result;
+}
+
+std::vector<Point> Index::nearest(const Point & point, std::size_t k) const
+{
+    if (k == 0 || size_ == 0) {
+        return {};
+    }
+    k = std::min(k, size_);
+    // Curve neighbours give an upper bound on the k-th distance ...
+    std::uint64_t q = key(quantize_x(point.x()), quantize_y(point.y()));
+    std::size_t position = std::lower_bound(keys_, keys_ + size_, q) - keys_;
+    std::size_t begin = position > k ? position - k : 0;
+    std::size_t end = std::min(size_, begin + 2 * k);
+    begin = end > 2 * k ? end - 2 * k : 0;
+    std::vector<double> guess;
+    guess.reserve(end - begin);
+    for (std::size_t i = begin; i < end; ++i) {
+        guess.push_back(point.distance(points_[i]));
+    }
+    std::nth_element(guess.begin(), guess.begin() + (k - 1), guess.end());
+    // Padded by a few ulps of the coordinates, so that rounding in the
+    // square's corners cannot leave out a point at exactly that distance.
+    double radius = guess[k - 1];
+    radius += (radius + std::max(std::abs(point.x()), std::abs(point.y()))) * 4 * std::numeric_limits<double>::epsilon();
+
+    // ... and one range query over that square finishes the search.
+    std::vector<std::pair<double, Point>> candidates;
+    scan(Rect({point.x() - radius, point.y() - radius}, {point.x() + radius, point.y() + radius}), [&](const Point & p) {
+        candidates.emplace_back(point.distance(p), p);
+    });
+    k = std::min(k, candidates.size());
+    auto closer = [](const auto & a, const auto & b) { return a.first < b.first; };
+    std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), closer);
+    std::vector<Point> result;
+    result.reserve(k);
+    for (std::size_t i = 0; i < k; ++i) {
+        result.push_back(candidates[i].second);
+    }
+    return result;
+}
+
+void Index::save(const std::string & filename) const
+{
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.curve = static_cast<std::uint32_t>(curve_);
+    header.size = size_;
+    header.xmin = bounds_.xmin();
+    header.ymin = bounds_.ymin();
+    header.xmax = bounds_.xmax();
+    header.ymax = bounds_.ymax();
+    header.scale_x = scale_x_;
+    header.scale_y = scale_y_;
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(keys_), static_cast<std::streamsize>(size_ * sizeof(std::uint64_t)));
+    out.write(reinterpret_cast<const char *>(points_), static_cast<std::streamsize>(size_ * sizeof(Point)));
+    if (!out) {
+        throw std::runtime_error("sfc::Index::save: cannot write " + filename);
+    }
+}
+
+Index Index::map(const std::string & filename)
+{
+    const char * data = nullptr;
+    std::size_t length = 0;
+    std::shared_ptr<const void> storage;
+#ifdef SFC_HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("sfc::Index::map: cannot open " + filename);
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    void * address = length ? ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("sfc::Index::map: cannot map " + filename);
+    }
+    storage = std::shared_ptr<const void>(address, [length](const void * p) { ::munmap(const_cast<void *>(p), length); });
+    data = static_cast<const char *>(address);
+#else
+    std::ifstream in(filename, std::ios::binary);
+    auto buffer = std::make_shared<std::vector<std::max_align_t>>();
+    in.seekg(0, std::ios::end);
+    length = static_cast<std::size_t>(in.tellg());
+    in.seekg(0);
+    buffer->resize((length + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+    in.read(reinterpret_cast<char *>(buffer->data()), static_cast<std::streamsize>(length));
+    data = reinterpret_cast<const char *>(buffer->data());
+    storage = buffer;
+#endif
+    Header header;
+    if (length < sizeof(header)) {
+        throw std::runtime_error("sfc::Index::map: truncated " + filename);
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        length != sizeof(header) + header.size * (sizeof(std::uint64_t) + sizeof(Point))) {
+        throw std::runtime_error("sfc::Index::map: not an index snapshot: " + filename);
+    }
+    Index index;
+    index.curve_ = static_cast<Curve>(header.curve);
+    index.bounds_ = Rect({header.xmin, header.ymin}, {header.xmax, header.ymax});
+    index.scale_x_ = header.scale_x;
+    index.scale_y_ = header.scale_y;
+    index.size_ = header.size;
+    index.keys_ = reinterpret_cast<const std::uint64_t *>(data + sizeof(header));
+    index.points_ = reinterpret_cast<const Point *>(data + sizeof(header) + header.size * sizeof(std::uint64_t));
+    index.storage_ = std::move(storage);
+    return index;
+}
+
+} // namespace sfc
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sfc {
+
+enum class Curve : std::uint32_t
+{
+    Morton,
+    Hilbert,
+};
+
+/*
+ * Static point index ordered along a space-filling curve.
+ *
+ * Coordinates are quantized to 32 bits per axis over the bounding box and
+ * interleaved into a 64-bit Morton (Z-order) or Hilbert key; points are
+ * stored sorted by key. A range query is decomposed into key intervals of
+ * quadtree cells, each located by binary search; nearest() takes the curve
+ * neighbours of the query as a first guess of the k-th distance and
+ * finishes with one range query. The index is immutable, and its sorted
+ * arrays can be written to a file and memory-mapped back without parsing.
+ */
+class Index
+{
+public:
+    Index() = default;
+    Index(const std::vector<Point> & points, Curve curve = Curve::Hilbert, unsigned threads = std::thread::hardware_concurrency());
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    Curve curve() const
+    {
+        return curve_;
+    }
+    Rect bounds() const
+    {
+        return bounds_;
+    }
+
+    bool contains(const Point &) const;
+    // Points inside the rect (boundary included), in curve order.
+    std::vector<Point> range(const Rect &) const;
+    std::size_t count(const Rect &) const;
+    // The k nearest points, closest first.
+    std::vector<Point> nearest(const Point &, std::size_t k) const;
+
+    // Points in curve order.
+    const Point * begin() const
+    {
+        return points_;
+    }
+    const Point * end() const
+    {
+        return points_ + size_;
+    }
+
+    // Binary snapshot: a header followed by the key and point arrays.
+    void save(const std::string & filename) const;
+    // Maps a snapshot read-only; the arrays are used in place.
+    static Index map(const std::string & filename);
+
+    static std::uint64_t morton(std::uint32_t x, std::uint32_t y);
+    static std::uint64_t hilbert(std::uint32_t x, std::uint32_t y);
+
+private:
+    struct Interval
+    {
+        std::uint64_t lo, hi;
+    };
+
+    std::uint32_t quantize_x(double) const;
+    std::uint32_t quantize_y(double) const;
+    std::uint64_t key(std::uint32_t qx, std::uint32_t qy) const;
+    void intervals(const Rect &, std::vector<Interval> &) const;
+    template <class F>
+    void scan(const Rect &, F && f) const;
+
+    Curve curve_ = Curve::Hilbert;
+    Rect bounds_;
+    double scale_x_ = 0, scale_y_ = 0;
+    std::size_t size_ = 0;
+    const std::uint64_t * keys_ = nullptr;
+    const Point * points_ = nullptr;
+    // Owns the arrays: either vectors built in memory or a file mapping.
+    std::shared_ptr<const void> storage_;
+};
+
+} // namespace sfc
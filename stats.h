@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+ * Per-query traversal counters. Counting is compiled in only when
+ * KDTREE_TRAVERSAL_STATS is defined; otherwise every KDTREE_STATS(...)
+ * statement disappears and the counters stay zero.
+ */
+#ifdef KDTREE_TRAVERSAL_STATS
+#define KDTREE_STATS(expr) expr
+#else
+#define KDTREE_STATS(expr)
+#endif
+
+namespace kdtree {
+
+struct QueryStats
+{
+    std::size_t nodes_visited = 0;
+    std::size_t subtrees_pruned = 0;
+    std::size_t distance_evaluations = 0; // point/rect distance and containment tests
+    std::size_t max_depth = 0;
+
+    void visit(std::size_t depth)
+    {
+        ++nodes_visited;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+};
+
+// Power-of-two buckets: bucket 0 holds 0, bucket i holds [2^(i-1), 2^i).
+// Counters are relaxed atomics, so const queries on one PointSet may record
+// from several threads at once; a reader racing with them may see a sample
+// counted in some fields and not yet in others.
+class Histogram
+{
+public:
+    static constexpr std::size_t buckets = 65;
+
+    Histogram() = default;
+    Histogram(const Histogram & another)
+    {
+        *this = another;
+    }
+
+    Histogram & operator=(const Histogram & another)
+    {
+        for (std::size_t i = 0; i < buckets; ++i) {
+            counts_[i].store(another.bucket(i), std::memory_order_relaxed);
+        }
+        count_.store(another.count(), std::memory_order_relaxed);
+        sum_.store(another.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        max_.store(another.max(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(std::uint64_t value)
+    {
+        std::size_t bucket = 0;
+        for (std::uint64_t v = value; v != 0; v >>= 1) {
+            ++bucket;
+        }
+        counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        raise_max(value);
+    }
+
+    std::uint64_t count() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        std::uint64_t count = this->count();
+        return count == 0 ? 0.0 : static_cast<double>(sum_.load(std::memory_order_relaxed)) / count;
+    }
+
+    std::uint64_t bucket(std::size_t i) const
+    {
+        return counts_[i].load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given quantile.
+    std::uint64_t quantile(double q) const
+    {
+        std::uint64_t rank = static_cast<std::uint64_t>(q * count());
+        std::uint64_t seen = 0, max = this->max();
+        for (std::size_t i = 0; i < buckets; ++i) {
+            seen += bucket(i);
+            if (seen > rank) {
+                return i == 0 ? 0 : (i >= 64 ? max : std::min(max, (std::uint64_t{1} << i) - 1));
+            }
+        }
+        return max;
+    }
+
+    void merge(const Histogram & another)
+    {
+        for (std::size_t i = 0; i < buckets; ++i) {
+            counts_[i].fetch_add(another.bucket(i), std::memory_order_relaxed);
+        }
+        count_.fetch_add(another.count(), std::memory_order_relaxed);
+        sum_.fetch_add(another.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        raise_max(another.max());
+    }
+
+    friend std::ostream & operator<<(std::ostream & out, const Histogram & histogram)
+    {
+        out << "count=" << histogram.count() << " mean=" << histogram.mean() << " p50<=" << histogram.quantile(0.5)
+            << " p99<=" << histogram.quantile(0.99) << " max=" << histogram.max();
+        return out;
+    }
+
+private:
+    void raise_max(std::uint64_t value)
+    {
+        std::uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::array<std::atomic<std::uint64_t>, buckets> counts_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+// Aggregate over all queries of one kind.
+struct TraversalHistograms
+{
+    Histogram nodes_visited;
+    Histogram subtrees_pruned;
+    Histogram distance_evaluations;
+    Histogram max_depth;
+
+    void record(const QueryStats & stats)
+    {
+        nodes_visited.add(stats.nodes_visited);
+        subtrees_pruned.add(stats.subtrees_pruned);
+        distance_evaluations.add(stats.distance_evaluations);
+        max_depth.add(stats.max_depth);
+    }
+
+    friend std::ostream & operator<<(std::ostream & out, const TraversalHistograms & h)
+    {
+        out << "nodes_visited: " << h.nodes_visited << '\n'
+            << "subtrees_pruned: " << h.subtrees_pruned << '\n'
+            << "distance_evaluations: " << h.distance_evaluations << '\n'
+            << "max_depth: " << h.max_depth << '\n';
+        return out;
+    }
+};
+
+struct TraversalStats
+{
+    TraversalHistograms range;
+    TraversalHistograms nearest;
+};
+
+// Shape and footprint of a tree, see PointSet::stats().
+struct TreeStats
+{
+    std::size_t size = 0;
+    bool flat = false;                      // small set stored as an array, no nodes
+    std::size_t height = 0;                 // nodes on the longest root-to-leaf path
+    std::vector<std::size_t> depth_counts;  // depth_counts[d] = nodes at depth d
+    std::size_t leaves = 0;
+    double average_leaf_depth = 0;
+    // Largest share of a node's subtree held by one child, over nodes whose
+    // subtree has at least three points; 0.5 is perfectly balanced, 1.0 is a list.
+    double worst_imbalance = 0;
+    std::size_t worst_imbalance_size = 0; // subtree size where it occurs
+    std::size_t tombstones = 0;             // erased nodes still linked into the tree
+    std::size_t node_bytes = 0;
+    std::size_t allocator_overhead_bytes = 0; // shared_ptr control blocks and malloc headers, estimated
+
+    friend std::ostream & operator<<(std::ostream & out, const TreeStats & stats)
+    {
+        out << "size: " << stats.size << (stats.flat ? " (flat)" : "") << '\n'
+            << "height: " << stats.height << '\n'
+            << "leaves: " << stats.leaves << '\n'
+            << "average_leaf_depth: " << stats.average_leaf_depth << '\n'
+            << "worst_imbalance: " << stats.worst_imbalance << " (subtree of " << stats.worst_imbalance_size << ")\n"
+            << "tombstones: " << stats.tombstones << '\n'
+            << "node_bytes: " << stats.node_bytes << '\n'
+            << "allocator_overhead_bytes: " << stats.allocator_overhead_bytes << '\n'
+            << "depth_counts:";
+        for (std::size_t count : stats.depth_counts) {
+            out << ' ' << count;
+        }
+        out << '\n';
+        return out;
+    }
+};
+
+} // namespace kdtree
@@ -0,0 +1,386 @@
+#include "tileload.h"
+
+#include "ingest.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define TILELOAD_HAVE_IO_URING 1
+#else
+#include <fstream>
+#endif
+
+namespace tileload {
+
+namespace {
+// Runs parse-and-build jobs on a fixed set of threads.
+class Workers
+{
+public:
+    explicit Workers(unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~Workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        ready_.notify_all();
+        for (auto & thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void post(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        ready_.notify_one();
+    }
+
+private:
+    void run()
+    {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return done_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> jobs_;
+    bool done_ = false;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
+
+bool read_file(const std::string & filename, std::vector<char> & data)
+{
+#ifdef TILELOAD_HAVE_IO_URING
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    data.resize(ok ? static_cast<std::size_t>(st.st_size) : 0);
+    for (std::size_t done = 0; ok && done < data.size();) {
+        ssize_t got = ::pread(fd, data.data() + done, data.size() - done, static_cast<off_t>(done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = got > 0;
+        done += ok ? static_cast<std::size_t>(got) : 0;
+    }
+    ::close(fd);
+    return ok;
+#else
+    std::ifstream in(filename, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return static_cast<bool>(in) || in.eof();
+#endif
+}
+
+#ifdef TILELOAD_HAVE_IO_URING
+// A minimal io_uring submission/completion ring driven by raw system calls.
+class Ring
+{
+public:
+    explicit Ring(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return;
+        }
+        entries_ = params.sq_entries;
+        sq_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+        }
+        sq_ = ::mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        cq_ = single ? sq_ : ::mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+        void * sqes = ::mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sq_ == MAP_FAILED || cq_ == MAP_FAILED || sqes == MAP_FAILED) {
+            if (sqes != MAP_FAILED) {
+                ::munmap(sqes, sqes_bytes_);
+            }
+            release();
+            return;
+        }
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+        char * sq = static_cast<char *>(sq_);
+        char * cq = static_cast<char *>(cq_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    ~Ring()
+    {
+        if (sqes_ != nullptr) {
+            ::munmap(sqes_, sqes_bytes_);
+        }
+        release();
+    }
+
+    bool ok() const
+    {
+        return sqes_ != nullptr;
+    }
+    unsigned entries() const
+    {
+        return entries_;
+    }
+
+    // Queues a read into [data, data + bytes) at the file offset.
+    void read(int fd, iovec * buffer, std::uint64_t offset, std::uint64_t user_data)
+    {
+        const unsigned tail = *sq_tail_;
+        const unsigned index = tail & sq_mask_;
+        io_uring_sqe & sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(buffer);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++pending_;
+    }
+
+    // Submits queued reads and waits for at least one completion.
+    bool submit_and_wait()
+    {
+        for (;;) {
+            long done = ::syscall(__NR_io_uring_enter, fd_, pending_, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (done >= 0) {
+                pending_ -= static_cast<unsigned>(done);
+                return true;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return false;
+            }
+        }
+    }
+
+    template <class F>
+    void drain(F && f)
+    {
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe & cqe = cqes_[head & cq_mask_];
+            f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void release()
+    {
+        if (cq_ != nullptr && cq_ != MAP_FAILED && cq_ != sq_) {
+            ::munmap(cq_, cq_bytes_);
+        }
+        if (sq_ != nullptr && sq_ != MAP_FAILED) {
+            ::munmap(sq_, sq_bytes_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        sq_ = cq_ = nullptr;
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    unsigned entries_ = 0;
+    unsigned pending_ = 0;
+    void * sq_ = nullptr;
+    void * cq_ = nullptr;
+    std::size_t sq_bytes_ = 0, cq_bytes_ = 0, sqes_bytes_ = 0;
+    io_uring_sqe * sqes_ = nullptr;
+    unsigned * sq_head_ = nullptr;
+    unsigned * sq_tail_ = nullptr;
+    unsigned * sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned * cq_head_ = nullptr;
+    unsigned * cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe * cqes_ = nullptr;
+};
+
+#endif
+
+using Finish = std::function<void(std::size_t, std::shared_ptr<std::vector<char>>)>;
+
+struct Read
+{
+    bool handled = false;
+#ifdef TILELOAD_HAVE_IO_URING
+    int fd = -1;
+    std::vector<char> data;
+    std::size_t done = 0;
+    iovec buffer;
+#endif
+};
+
+#ifdef TILELOAD_HAVE_IO_URING
+// Returns false if the ring stops working; files not yet handed to the
+// workers are then left for the fallback path. The buffers in `reads` must
+// outlive the ring.
+bool load_with_ring(Ring & ring, const std::vector<std::string> & files, std::vector<Read> & reads, Workers & workers, const Finish & finish)
+{
+    std::size_t next = 0, in_flight = 0;
+    auto queue = [&](std::size_t i) {
+        Read & read = reads[i];
+        read.buffer = {read.data.data() + read.done, read.data.size() - read.done};
+        ring.read(read.fd, &read.buffer, read.done, i);
+    };
+    auto complete = [&](std::size_t i, bool ok) {
+        Read & read = reads[i];
+        if (read.fd >= 0) {
+            ::close(read.fd);
+            read.fd = -1;
+        }
+        read.handled = true;
+        auto data = ok ? std::make_shared<std::vector<char>>(std::move(read.data)) : nullptr;
+        workers.post([&finish, i, data] { finish(i, data); });
+    };
+    while (next < files.size() || in_flight != 0) {
+        for (; next < files.size() && in_flight < ring.entries(); ++next) {
+            Read & read = reads[next];
+            read.fd = ::open(files[next].c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (read.fd < 0 || ::fstat(read.fd, &st) != 0) {
+                complete(next, false);
+                continue;
+            }
+            read.data.resize(static_cast<std::size_t>(st.st_size));
+            if (read.data.empty()) {
+                complete(next, true);
+                continue;
+            }
+            queue(next);
+            ++in_flight;
+        }
+        if (in_flight == 0) {
+            continue;
+        }
+        if (!ring.submit_and_wait()) {
+            return false;
+        }
+        ring.drain([&](std::uint64_t i, int result) {
+            Read & read = reads[i];
+            if (result == -EINTR || result == -EAGAIN) {
+                queue(i);
+                return;
+            }
+            if (result > 0) {
+                read.done += static_cast<std::size_t>(result);
+                if (read.done < read.data.size()) {
+                    queue(i);
+                    return;
+                }
+            }
+            --in_flight;
+            // A short file (result 0) or an error ends the read.
+            complete(i, result > 0);
+        });
+    }
+    return true;
+}
+#endif
+} // namespace
+
+std::vector<kdtree::PointSet> load(const std::vector<std::string> & files, const Options & options)
+{
+    LoadStats stats;
+    return load(files, options, stats);
+}
+
+std::vector<kdtree::PointSet> load(const std::vector<std::string> & files, const Options & options, LoadStats & stats)
+{
+    std::vector<kdtree::PointSet> sets(files.size());
+    std::atomic<std::size_t> failed{0}, bytes{0};
+    Finish finish = [&](std::size_t i, std::shared_ptr<std::vector<char>> data) {
+        if (data == nullptr) {
+            ++failed;
+            return;
+        }
+        bytes += data->size();
+        // The workers already run one tile each, so every tile builds on
+        // its own thread.
+        sets[i] = kdtree::PointSet(ingest::parse_points(data->data(), data->data() + data->size()), 1);
+    };
+    stats = {};
+    stats.files = files.size();
+    std::vector<Read> reads(files.size());
+    {
+        Workers workers(std::max(1u, options.workers));
+#ifdef TILELOAD_HAVE_IO_URING
+        if (options.use_io_uring) {
+            Ring ring(std::max(1u, options.queue_depth));
+            stats.io_uring = ring.ok() && load_with_ring(ring, files, reads, workers, finish);
+        }
+#endif
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            if (reads[i].handled) {
+                continue;
+            }
+#ifdef TILELOAD_HAVE_IO_URING
+            if (reads[i].fd >= 0) {
+                ::close(reads[i].fd);
+            }
+#endif
+            workers.post([&files, &finish, i] {
+                auto data = std::make_shared<std::vector<char>>();
+                finish(i, read_file(files[i], *data) ? data : nullptr);
+            });
+        }
+    }
+    stats.failed = failed;
+    stats.bytes = bytes;
+    return sets;
+}
+
+} // namespace tileload
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tileload {
+
+struct Options
+{
+    unsigned queue_depth = 64; // reads in flight
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    bool use_io_uring = true;  // false forces the thread-pool path
+};
+
+struct LoadStats
+{
+    bool io_uring = false; // whether reads went through io_uring
+    std::size_t files = 0;
+    std::size_t failed = 0; // files that could not be opened or read
+    std::size_t bytes = 0;
+};
+
+/*
+ * Loads one PointSet per file of "x y" lines, in the order given. Reads are
+ * submitted through io_uring (raw system calls, Linux 5.1+) with up to
+ * queue_depth in flight; each completed buffer is parsed and built on a
+ * worker thread while further reads are outstanding. Where io_uring is not
+ * available, worker threads read the files themselves. Files that cannot
+ * be read give empty sets.
+ */
+std::vector<kdtree::PointSet> load(const std::vector<std::string> & files, const Options & options = {});
+std::vector<kdtree::PointSet> load(const std::vector<std::string> & files, const Options & options, LoadStats & stats);
+
+} // namespace tileload
@@ -0,0 +1,552 @@
+#include "wal.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace wal {
+
+namespace {
+constexpr char log_magic[8] = {'P', 'S', 'W', 'A', 'L', '0', '0', '1'};
+constexpr char snapshot_magic[8] = {'P', 'S', 'S', 'N', 'A', 'P', '0', '1'};
+
+enum Record : std::uint8_t
+{
+    Put = 1,
+    Erase = 2,
+};
+
+// crc32c, type, x, y
+constexpr std::size_t record_size = 4 + 1 + 2 * sizeof(double);
+
+struct LogHeader
+{
+    char magic[8];
+    std::uint64_t generation;
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint64_t generation;
+    std::uint64_t count;
+    std::uint32_t crc;
+    std::uint32_t reserved;
+};
+
+// CRC-32C, with the SSE4.2 instruction when the target has it.
+std::uint32_t crc32c(const char * data, std::size_t size)
+{
+    std::uint32_t crc = ~0u;
+#ifdef __SSE4_2__
+    std::uint64_t wide = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<std::uint32_t>(wide);
+    for (; size != 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    }
+#else
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> result{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value >> 1) ^ ((value & 1u) ? 0x82F63B78u : 0u);
+            }
+            result[i] = value;
+        }
+        return result;
+    }();
+    for (; size != 0; ++data, --size) {
+        crc = table[(crc ^ static_cast<unsigned char>(*data)) & 0xFFu] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+}
+
+void encode(std::uint8_t type, const Point & point, char * to)
+{
+    double x = point.x(), y = point.y();
+    to[4] = static_cast<char>(type);
+    std::memcpy(to + 5, &x, sizeof(double));
+    std::memcpy(to + 5 + sizeof(double), &y, sizeof(double));
+    std::uint32_t crc = crc32c(to + 4, record_size - 4);
+    std::memcpy(to, &crc, 4);
+}
+
+bool write_all(int fd, const char * data, std::size_t bytes)
+{
+    while (bytes != 0) {
+        ssize_t done = ::write(fd, data, bytes);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        bytes -= static_cast<std::size_t>(done);
+    }
+    return true;
+}
+
+bool read_file(const std::string & filename, std::vector<char> & to)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    bool ok = ::fstat(fd, &info) == 0;
+    if (ok) {
+        to.resize(static_cast<std::size_t>(info.st_size));
+        std::size_t done = 0;
+        while (ok && done < to.size()) {
+            ssize_t got = ::read(fd, to.data() + done, to.size() - done);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            ok = got > 0;
+            done += ok ? static_cast<std::size_t>(got) : 0;
+        }
+    }
+    ::close(fd);
+    if (!ok) {
+        throw std::runtime_error("wal: cannot read " + filename);
+    }
+    return true;
+}
+
+void sync_directory(const std::string & directory)
+{
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::string log_name(const std::string & directory, std::uint64_t generation)
+{
+    return directory + "/wal." + std::to_string(generation);
+}
+
+// Generations of the logs in the directory, ascending.
+std::vector<std::uint64_t> list_logs(const std::string & directory)
+{
+    std::vector<std::uint64_t> result;
+    DIR * dir = ::opendir(directory.c_str());
+    if (dir == nullptr) {
+        throw std::runtime_error("wal: cannot open " + directory);
+    }
+    while (dirent * entry = ::readdir(dir)) {
+        const char * name = entry->d_name;
+        if (std::strncmp(name, "wal.", 4) != 0 || name[4] == '\0') {
+            continue;
+        }
+        char * end = nullptr;
+        std::uint64_t generation = std::strtoull(name + 4, &end, 10);
+        if (*end == '\0') {
+            result.push_back(generation);
+        }
+    }
+    ::closedir(dir);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Opens the log for appending, writing its header if it has none.
+int open_log(const std::string & directory, std::uint64_t generation)
+{
+    const std::string filename = log_name(directory, generation);
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        LogHeader header{};
+        std::memcpy(header.magic, log_magic, sizeof(log_magic));
+        header.generation = generation;
+        if (!write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header)) || ::fdatasync(fd) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        sync_directory(directory);
+    }
+    return fd;
+}
+} // namespace
+
+DurableSet::DurableSet(const std::string & directory, Options options)
+    : directory_(directory)
+    , options_(options)
+{
+    recover();
+    committer_ = std::thread(&DurableSet::commit_loop, this);
+}
+
+DurableSet::~DurableSet()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    pending_cv_.notify_one();
+    committer_.join();
+    if (checkpointer_.joinable()) {
+        checkpointer_.join();
+    }
+    if (log_fd_ >= 0) {
+        ::close(log_fd_);
+    }
+}
+
+void DurableSet::recover()
+{
+    if (::mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("wal: cannot create " + directory_);
+    }
+    ::unlink((directory_ + "/snapshot.tmp").c_str());
+
+    std::vector<char> data;
+    std::vector<Point> points;
+    if (read_file(directory_ + "/snapshot", data)) {
+        SnapshotHeader header;
+        if (data.size() < sizeof(header)) {
+            throw std::runtime_error("wal: truncated snapshot in " + directory_);
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        const char * body = data.data() + sizeof(header);
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+            data.size() - sizeof(header) != header.count * sizeof(Point) ||
+            crc32c(body, data.size() - sizeof(header)) != header.crc) {
+            throw std::runtime_error("wal: corrupt snapshot in " + directory_);
+        }
+        points.resize(header.count, Point(0, 0));
+        std::memcpy(static_cast<void *>(points.data()), body, header.count * sizeof(Point));
+        recovery_.generation = header.generation;
+        recovery_.snapshot_points = header.count;
+    }
+    set_ = kdtree::PointSet(std::move(points));
+    generation_ = recovery_.generation;
+
+    // Logs older than the snapshot are already in it; the rest are replayed
+    // in order. Only the newest can end in a torn write: a log is synced
+    // before the next one is created, so a bad record or header in an older
+    // log is corruption, and replaying past it would lose updates silently.
+    const std::vector<std::uint64_t> logs = list_logs(directory_);
+    for (std::uint64_t generation : logs) {
+        const std::string filename = log_name(directory_, generation);
+        if (generation < recovery_.generation) {
+            ::unlink(filename.c_str());
+            continue;
+        }
+        generation_ = generation;
+        read_file(filename, data);
+        LogHeader header;
+        std::size_t valid = 0;
+        if (data.size() >= sizeof(header)) {
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (std::memcmp(header.magic, log_magic, sizeof(log_magic)) == 0 && header.generation == generation) {
+                valid = sizeof(header);
+            }
+        }
+        if (valid != 0) {
+            ++recovery_.logs;
+            for (; valid + record_size <= data.size(); valid += record_size) {
+                const char * record = data.data() + valid;
+                std::uint32_t crc;
+                std::memcpy(&crc, record, 4);
+                if (crc != crc32c(record + 4, record_size - 4)) {
+                    break;
+                }
+                double x, y;
+                std::memcpy(&x, record + 5, sizeof(double));
+                std::memcpy(&y, record + 5 + sizeof(double), sizeof(double));
+                if (record[4] == Put) {
+                    set_.put({x, y});
+                }
+                else {
+                    set_.erase({x, y});
+                }
+                ++recovery_.records;
+            }
+        }
+        if (valid != data.size()) {
+            if (generation != logs.back()) {
+                throw std::runtime_error("wal: corrupt log " + filename);
+            }
+            recovery_.torn_bytes += data.size() - valid;
+            if (::truncate(filename.c_str(), static_cast<off_t>(valid)) != 0) {
+                throw std::runtime_error("wal: cannot truncate " + filename);
+            }
+        }
+    }
+
+    log_fd_ = open_log(directory_, generation_);
+    if (log_fd_ < 0) {
+        throw std::runtime_error("wal: cannot open " + log_name(directory_, generation_));
+    }
+    struct stat info;
+    ::fstat(log_fd_, &info);
+    log_bytes_ = static_cast<std::uint64_t>(info.st_size);
+}
+
+void DurableSet::put(const Point & point)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A point already in the set needs no record; it is as durable as the
+    // updates before it.
+    const std::uint64_t ticket = set_.contains(point) ? appended_ : append(Put, point);
+    set_.put(point);
+    if (options_.wait_for_sync) {
+        wait_durable(ticket, lock);
+    }
+}
+
+bool DurableSet::erase(const Point & point)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!set_.contains(point)) {
+        return false;
+    }
+    const std::uint64_t ticket = append(Erase, point);
+    set_.erase(point);
+    if (options_.wait_for_sync) {
+        wait_durable(ticket, lock);
+    }
+    return true;
+}
+
+bool DurableSet::contains(const Point & point) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return set_.contains(point);
+}
+
+std::size_t DurableSet::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return set_.size();
+}
+
+std::uint64_t DurableSet::append(std::uint8_t type, const Point & point)
+{
+    if (failed_) {
+        throw std::runtime_error("wal: log write failed in " + directory_);
+    }
+    std::size_t at = pending_.size();
+    pending_.resize(at + record_size);
+    encode(type, point, pending_.data() + at);
+    if (at == 0) {
+        pending_cv_.notify_one();
+    }
+    return ++appended_;
+}
+
+void DurableSet::wait_durable(std::uint64_t ticket, std::unique_lock<std::mutex> & lock)
+{
+    durable_cv_.wait(lock, [&] { return durable_ >= ticket || failed_; });
+    if (durable_ < ticket) {
+        throw std::runtime_error("wal: log write failed in " + directory_);
+    }
+}
+
+void DurableSet::undo(const std::vector<char> & records)
+{
+    for (std::size_t at = records.size(); at >= record_size; at -= record_size) {
+        const char * record = records.data() + at - record_size;
+        double x, y;
+        std::memcpy(&x, record + 5, sizeof(double));
+        std::memcpy(&y, record + 5 + sizeof(double), sizeof(double));
+        if (record[4] == Put) {
+            set_.erase({x, y});
+        }
+        else {
+            set_.put({x, y});
+        }
+    }
+}
+
+void DurableSet::sync()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    wait_durable(appended_, lock);
+}
+
+void DurableSet::checkpoint()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!checkpointing_ && !rotating_) {
+        start_checkpoint(lock);
+    }
+}
+
+void DurableSet::wait_checkpoint()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_cv_.wait(lock, [&] { return !checkpointing_; });
+    if (checkpoint_failed_) {
+        checkpoint_failed_ = false;
+        throw std::runtime_error("wal: checkpoint failed in " + directory_);
+    }
+}
+
+void DurableSet::start_checkpoint(std::unique_lock<std::mutex> &)
+{
+    if (checkpointer_.joinable()) {
+        checkpointer_.join();
+    }
+    checkpointing_ = true;
+    // Everything applied so far goes into the snapshot; the commit thread
+    // sends what is still pending to the old log and the rest to the new.
+    Snapshot snapshot{++generation_, std::vector<Point>(set_.begin(), set_.end())};
+    rotating_ = true;
+    rotate_at_ = pending_.size();
+    pending_cv_.notify_one();
+    checkpointer_ = std::thread(&DurableSet::write_snapshot, this, std::move(snapshot));
+}
+
+void DurableSet::commit_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<char> batch;
+    while (true) {
+        pending_cv_.wait(lock, [&] { return stop_ || rotating_ || !pending_.empty(); });
+        if (stop_ && !rotating_ && pending_.empty()) {
+            return;
+        }
+        if (options_.commit_delay.count() > 0 && !stop_) {
+            pending_cv_.wait_for(lock, options_.commit_delay, [&] { return stop_; });
+        }
+        batch.clear();
+        batch.swap(pending_);
+        const bool rotate = rotating_;
+        const std::size_t split = rotate ? rotate_at_ : batch.size();
+        const std::uint64_t generation = generation_;
+        const std::uint64_t ticket = appended_;
+        lock.unlock();
+
+        bool ok = split == 0 || (write_all(log_fd_, batch.data(), split) && ::fdatasync(log_fd_) == 0);
+        // Bytes of the batch known to be on disk.
+        const std::size_t written = ok ? split : 0;
+        int next_fd = -1;
+        if (ok && rotate) {
+            next_fd = open_log(directory_, generation);
+            ok = next_fd >= 0 && (split == batch.size() ||
+                    (write_all(next_fd, batch.data() + split, batch.size() - split) && ::fdatasync(next_fd) == 0));
+        }
+
+        lock.lock();
+        if (!ok) {
+            // Every update is applied as soon as its record is queued; take
+            // back those whose records did not reach the disk, newest first,
+            // so that the set matches the log.
+            failed_ = true;
+            durable_ = ticket - (batch.size() - written) / record_size;
+            batch.erase(batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(written));
+            batch.insert(batch.end(), pending_.begin(), pending_.end());
+            pending_.clear();
+            undo(batch);
+            // Cut off whatever part of the failed write did land, so that
+            // recovery finds the same set; if that fails too, the rest
+            // reads as a torn tail.
+            if (written == 0) {
+                [[maybe_unused]] int ignored = ::ftruncate(log_fd_, static_cast<off_t>(log_bytes_));
+            }
+            if (next_fd >= 0) {
+                [[maybe_unused]] int ignored = ::ftruncate(next_fd, sizeof(LogHeader));
+                ::close(next_fd);
+            }
+            durable_cv_.notify_all();
+            return;
+        }
+        if (rotate) {
+            ::close(log_fd_);
+            log_fd_ = next_fd;
+            log_bytes_ = sizeof(LogHeader) + (batch.size() - split);
+            rotating_ = false;
+        }
+        else {
+            log_bytes_ += batch.size();
+        }
+        durable_ = ticket;
+        durable_cv_.notify_all();
+        if (options_.checkpoint_bytes != 0 && log_bytes_ > options_.checkpoint_bytes && !checkpointing_ && !stop_) {
+            start_checkpoint(lock);
+        }
+    }
+}
+
+void DurableSet::write_snapshot(Snapshot snapshot)
+{
+    // Sorted, so that recovery builds the tree without sorting again.
+    std::sort(snapshot.points.begin(), snapshot.points.end(), LessXY());
+    const char * body = reinterpret_cast<const char *>(snapshot.points.data());
+    const std::size_t bytes = snapshot.points.size() * sizeof(Point);
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.generation = snapshot.generation;
+    header.count = snapshot.points.size();
+    header.crc = crc32c(body, bytes);
+
+    const std::string temporary = directory_ + "/snapshot.tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 &&
+            write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header)) &&
+            write_all(fd, body, bytes) &&
+            ::fsync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    {
+        // The snapshot holds updates that the old log has not synced yet;
+        // it may replace the logs only once they are on disk.
+        std::unique_lock<std::mutex> lock(mutex_);
+        durable_cv_.wait(lock, [&] { return !rotating_ || failed_; });
+        ok = ok && !failed_;
+    }
+    ok = ok && ::rename(temporary.c_str(), (directory_ + "/snapshot").c_str()) == 0;
+    if (ok) {
+        sync_directory(directory_);
+        // Left-over logs are harmless: recovery skips and deletes them.
+        try {
+            for (std::uint64_t generation : list_logs(directory_)) {
+                if (generation < snapshot.generation) {
+                    ::unlink(log_name(directory_, generation).c_str());
+                }
+            }
+        }
+        catch (const std::runtime_error &) {
+        }
+    }
+    else {
+        ::unlink(temporary.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    checkpointing_ = false;
+    checkpoint_failed_ = !ok;
+    durable_cv_.notify_all();
+}
+
+} // namespace wal
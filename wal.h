@@ -0,0 +1,127 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wal {
+
+struct Options
+{
+    // put() and erase() return only once their record is on disk. Without
+    // it they return at once and the record reaches disk with the next
+    // group commit.
+    bool wait_for_sync = true;
+    // How long the commit thread lingers to collect more records into one
+    // fsync; 0 commits whatever is pending as soon as the disk is free.
+    std::chrono::microseconds commit_delay{0};
+    // A checkpoint starts by itself once the log has grown past this many
+    // bytes; 0 leaves checkpoints to the caller.
+    std::uint64_t checkpoint_bytes = 64u << 20;
+};
+
+struct RecoveryStats
+{
+    std::uint64_t generation = 0;
+    std::size_t snapshot_points = 0;
+    std::size_t records = 0;        // log records replayed
+    std::size_t logs = 0;           // log files replayed
+    std::uint64_t torn_bytes = 0;   // cut from the end of the last log
+
+    friend std::ostream & operator<<(std::ostream & out, const RecoveryStats & stats)
+    {
+        return out << "generation " << stats.generation << ", snapshot points " << stats.snapshot_points
+                   << ", records " << stats.records << " in " << stats.logs << " logs, torn bytes " << stats.torn_bytes;
+    }
+};
+
+/*
+ * A kdtree::PointSet whose updates survive a crash. The directory holds the
+ * latest snapshot and the logs written since; opening it loads the snapshot
+ * and replays the logs on top. Every put() and erase() that changes the set
+ * appends a CRC-framed record, and a commit thread writes and fsyncs everything pending in one
+ * go, so concurrent writers share the cost of a sync. checkpoint() switches
+ * to a fresh log and writes a snapshot in the background; the old logs are
+ * deleted once the snapshot is durable.
+ */
+class DurableSet
+{
+public:
+    explicit DurableSet(const std::string & directory, Options options = {});
+    ~DurableSet();
+
+    DurableSet(const DurableSet &) = delete;
+    DurableSet & operator=(const DurableSet &) = delete;
+
+    void put(const Point &);
+    bool erase(const Point &);
+    bool contains(const Point &) const;
+    std::size_t size() const;
+
+    // Waits until every update made so far is on disk.
+    void sync();
+    // Starts a checkpoint unless one is already running.
+    void checkpoint();
+    // Waits for a running checkpoint to finish.
+    void wait_checkpoint();
+
+    const RecoveryStats & recovery() const
+    {
+        return recovery_;
+    }
+    // Not synchronised with concurrent put() and erase().
+    const kdtree::PointSet & points() const
+    {
+        return set_;
+    }
+
+private:
+    struct Snapshot
+    {
+        std::uint64_t generation;
+        std::vector<Point> points;
+    };
+
+    void recover();
+    // Queues a record and returns its ticket; throws, queuing nothing, once
+    // a log write has failed.
+    std::uint64_t append(std::uint8_t type, const Point & point);
+    void wait_durable(std::uint64_t ticket, std::unique_lock<std::mutex> & lock);
+    // Reverts the updates of the given records, newest first.
+    void undo(const std::vector<char> & records);
+    void start_checkpoint(std::unique_lock<std::mutex> & lock);
+    void commit_loop();
+    void write_snapshot(Snapshot snapshot);
+
+    std::string directory_;
+    Options options_;
+    kdtree::PointSet set_;
+    RecoveryStats recovery_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable pending_cv_;
+    std::condition_variable durable_cv_;
+    std::vector<char> pending_;
+    // Bytes of pending_ that still belong to the log being rotated out.
+    std::size_t rotate_at_ = 0;
+    bool rotating_ = false;
+    std::uint64_t appended_ = 0; // records handed to the log
+    std::uint64_t durable_ = 0;  // records known to be on disk
+    std::uint64_t log_bytes_ = 0;
+    std::uint64_t generation_ = 0;
+    bool checkpointing_ = false;
+    bool checkpoint_failed_ = false;
+    bool failed_ = false; // a log write or sync failed; unsynced updates are undone, no more are accepted
+    bool stop_ = false;
+    int log_fd_ = -1;
+    std::thread committer_;
+    std::thread checkpointer_;
+};
+
+} // namespace wal